@@ -0,0 +1,958 @@
+#include "cflags.hpp"
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Count every C++ allocation, the C API counts its own through CFLAGS_MALLOC
+
+static size_t bench_cpp_allocation_count = 0;
+
+void * operator new(size_t size)
+{
+    ++bench_cpp_allocation_count;
+    if (void * ptr = malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void * ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void * ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+static size_t bench_cpp_allocations()
+{
+    return bench_cpp_allocation_count;
+}
+
+struct bench_options
+{
+    std::string api = "all";
+    std::string filter;
+    bool quick = false;
+    double min_time_ms = 50.0;
+};
+
+struct measurement
+{
+    size_t iterations;
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+// Run op repeatedly until min_time_ms has passed, after one untimed warmup run
+template <class Op>
+static measurement measure(const bench_options& options, size_t (*allocations)(), Op&& op)
+{
+    using clock = std::chrono::steady_clock;
+
+    op();
+
+    size_t iterations = 0;
+    size_t allocations_start = allocations();
+    auto start = clock::now();
+    std::chrono::duration<double, std::milli> elapsed(0);
+    do {
+        op();
+        ++iterations;
+        elapsed = clock::now() - start;
+    } while (elapsed.count() < options.min_time_ms);
+
+    measurement result;
+    result.iterations = iterations;
+    result.ns_per_op = (elapsed.count() * 1e6) / static_cast<double>(iterations);
+    result.allocs_per_op = static_cast<double>(allocations() - allocations_start) / static_cast<double>(iterations);
+    return result;
+}
+
+// One JSON object per line, so runs can be diffed or loaded with any JSON lines reader
+static void report(const char * api, const char * name, int flag_count, int arg_count, const measurement& result, unsigned threads = 1)
+{
+    printf(
+        "{\"api\":\"%s\",\"case\":\"%s\",\"flags\":%d,\"args\":%d,\"threads\":%u,\"iterations\":%zu,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f}\n",
+        api, name, flag_count, arg_count, threads, result.iterations, result.ns_per_op, result.allocs_per_op
+    );
+    fflush(stdout);
+}
+
+static bool enabled(const bench_options& options, const char * api, const char * name)
+{
+    return (options.api == "all" || options.api == api) &&
+        (options.filter.empty() || std::string(name).find(options.filter) != std::string::npos);
+}
+
+///
+/// Flag sets and command lines
+///
+
+// Flags 0-25 are bools with the short names a-z, the rest are ints with only a long name
+struct flag_set
+{
+    std::vector<std::string> long_name_storage;
+    std::vector<const char *> long_names;
+    std::string short_names;
+
+    explicit flag_set(int flag_count, const char * suffix = "")
+    {
+        char buffer[64];
+        for (int i = 0; i < flag_count; ++i) {
+            snprintf(buffer, sizeof(buffer), "flag-%05d%s", i, suffix);
+            long_name_storage.push_back(buffer);
+            short_names.push_back(i < 26 ? static_cast<char>('a' + i) : '\0');
+        }
+        for (auto& name : long_name_storage) {
+            long_names.push_back(name.c_str());
+        }
+    }
+
+    int size() const
+    {
+        return static_cast<int>(long_names.size());
+    }
+
+    int short_count() const
+    {
+        return (size() < 26 ? size() : 26);
+    }
+};
+
+struct command_line
+{
+    std::vector<std::string> storage;
+    std::vector<char *> argv;
+
+    void add(std::string arg)
+    {
+        storage.push_back(std::move(arg));
+    }
+
+    void finish()
+    {
+        argv.clear();
+        for (auto& arg : storage) {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(nullptr);
+    }
+
+    int argc() const
+    {
+        return static_cast<int>(argv.size()) - 1;
+    }
+};
+
+// `--name value` pairs spread across every flag
+static command_line make_long_args(const flag_set& flags, int arg_count)
+{
+    command_line line;
+    line.add("bench");
+    for (int i = 0; i < arg_count / 2; ++i) {
+        line.add(std::string("--") + flags.long_names[(i * 7919) % flags.size()]);
+        line.add("1");
+    }
+    line.finish();
+    return line;
+}
+
+// Clusters of up to 8 short bool flags, e.g. `-abcdefgh`
+static command_line make_short_args(const flag_set& flags, int arg_count)
+{
+    command_line line;
+    line.add("bench");
+    int cluster_size = (flags.short_count() < 8 ? flags.short_count() : 8);
+    for (int i = 0; i < arg_count; ++i) {
+        std::string arg = "-";
+        for (int j = 0; j < cluster_size; ++j) {
+            arg += flags.short_names[(i + j) % flags.short_count()];
+        }
+        line.add(arg);
+    }
+    line.finish();
+    return line;
+}
+
+// `--name value` pairs for the int flags only, with values of varying length that never start with `-`
+static command_line make_numeric_args(const flag_set& flags, int arg_count)
+{
+    command_line line;
+    line.add("bench");
+    int int_count = flags.size() - flags.short_count();
+    for (int i = 0; i < arg_count / 2; ++i) {
+        line.add(std::string("--") + flags.long_names[flags.short_count() + (i * 7919) % int_count]);
+        line.add(std::to_string((i * 104729) % 1000000));
+    }
+    line.finish();
+    return line;
+}
+
+// `--name value` pairs for the int flags, each name cut short by `trim` characters
+static command_line make_prefix_args(const flag_set& flags, int arg_count, size_t trim)
+{
+    command_line line;
+    line.add("bench");
+    int int_count = flags.size() - flags.short_count();
+    for (int i = 0; i < arg_count / 2; ++i) {
+        std::string name = flags.long_names[flags.short_count() + (i * 7919) % int_count];
+        line.add("--" + name.substr(0, name.size() - trim));
+        line.add("1");
+    }
+    line.finish();
+    return line;
+}
+
+// A single `--ids a,b,c,...` list with `element_count` elements
+static command_line make_list_args(int element_count)
+{
+    command_line line;
+    line.add("bench");
+    line.add("--ids");
+    std::string list;
+    for (int i = 0; i < element_count; ++i) {
+        if (i > 0) {
+            list += ',';
+        }
+        list += std::to_string(i);
+    }
+    line.add(list);
+    line.finish();
+    return line;
+}
+
+static command_line make_positional_args(int arg_count)
+{
+    command_line line;
+    line.add("bench");
+    for (int i = 0; i < arg_count; ++i) {
+        line.add("file-" + std::to_string(i) + ".txt");
+    }
+    line.finish();
+    return line;
+}
+
+///
+/// C++ API
+///
+
+static int bench_cpp_values[BENCH_MAX_FLAGS];
+
+template <class Parser>
+static void register_cpp(Parser& parser, const flag_set& flags)
+{
+    for (int i = 0; i < flags.size(); ++i) {
+        if (flags.short_names[i] != '\0') {
+            parser.add_bool(flags.short_names[i], flags.long_names[i], nullptr, "benchmark flag");
+        }
+        else {
+            parser.add_int('\0', flags.long_names[i], &bench_cpp_values[i], "benchmark flag");
+        }
+    }
+    parser.freeze();
+}
+
+///
+/// Benchmarks
+///
+
+static volatile double bench_checksum = 0.0;
+
+static void bench_register(const bench_options& options, const flag_set& flags)
+{
+    if (enabled(options, "c", "register")) {
+        auto result = measure(options, bench_c_allocations, [&]() {
+            bench_c_free(bench_c_register(flags.size(), flags.long_names.data(), flags.short_names.data()));
+        });
+        report("c", "register", flags.size(), 0, result);
+    }
+
+    if (enabled(options, "cpp", "register")) {
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            cflags::cflags parser;
+            register_cpp(parser, flags);
+        });
+        report("cpp", "register", flags.size(), 0, result);
+    }
+}
+
+static void bench_parse(const bench_options& options, const char * name, const flag_set& flags, command_line& line)
+{
+    if (enabled(options, "c", name)) {
+        void * parser = bench_c_register(flags.size(), flags.long_names.data(), flags.short_names.data());
+        auto result = measure(options, bench_c_allocations, [&]() {
+            if (!bench_c_parse(parser, line.argc(), line.argv.data())) {
+                abort();
+            }
+        });
+        bench_c_free(parser);
+        report("c", name, flags.size(), line.argc() - 1, result);
+    }
+
+    if (enabled(options, "cpp", name)) {
+        cflags::cflags parser;
+        register_cpp(parser, flags);
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            if (!parser.parse(line.argc(), line.argv.data())) {
+                abort();
+            }
+        });
+        report("cpp", name, flags.size(), line.argc() - 1, result);
+    }
+
+    // Values are only recorded, the cost of converting them moves to the first get()
+    if (enabled(options, "lazy", name)) {
+        cflags::cflags parser;
+        register_cpp(parser, flags);
+        parser.lazy = true;
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            if (!parser.parse(line.argc(), line.argv.data())) {
+                abort();
+            }
+        });
+        report("lazy", name, flags.size(), line.argc() - 1, result);
+    }
+
+    if (enabled(options, "schema", name)) {
+        cflags::schema schema;
+        register_cpp(schema, flags);
+        cflags::result parsed;
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            if (!schema.parse(line.argc(), line.argv.data(), parsed)) {
+                abort();
+            }
+        });
+        report("schema", name, flags.size(), line.argc() - 1, result);
+    }
+}
+
+static void bench_parse_list(const bench_options& options, int element_count, command_line& line)
+{
+    if (enabled(options, "c", "parse_list")) {
+        void * parser = bench_c_register_list();
+        auto result = measure(options, bench_c_allocations, [&]() {
+            if (!bench_c_parse(parser, line.argc(), line.argv.data())) {
+                abort();
+            }
+        });
+        bench_c_free(parser);
+        report("c", "parse_list", 1, element_count, result);
+    }
+
+    if (enabled(options, "cpp", "parse_list")) {
+        std::vector<int> ids;
+        cflags::cflags parser;
+        parser.add_int_list('\0', "ids", &ids, "benchmark list");
+        parser.freeze();
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            if (!parser.parse(line.argc(), line.argv.data())) {
+                abort();
+            }
+        });
+        report("cpp", "parse_list", 1, element_count, result);
+    }
+}
+
+// Every long name is given as an unambiguous prefix, so each lookup misses the hash table first
+// The linear API is the lookup a getopt_long() style parser does, comparing the prefix with every name
+static void bench_parse_prefix(const bench_options& options, const flag_set& flags, command_line& line)
+{
+    if (enabled(options, "c", "parse_prefix")) {
+        void * parser = bench_c_register_prefix(flags.size(), flags.long_names.data(), flags.short_names.data());
+        auto result = measure(options, bench_c_allocations, [&]() {
+            if (!bench_c_parse(parser, line.argc(), line.argv.data())) {
+                abort();
+            }
+        });
+        bench_c_free(parser);
+        report("c", "parse_prefix", flags.size(), line.argc() - 1, result);
+    }
+
+    if (enabled(options, "cpp", "parse_prefix")) {
+        cflags::cflags parser;
+        parser.prefix_matching = true;
+        register_cpp(parser, flags);
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            if (!parser.parse(line.argc(), line.argv.data())) {
+                abort();
+            }
+        });
+        report("cpp", "parse_prefix", flags.size(), line.argc() - 1, result);
+    }
+
+    if (enabled(options, "linear", "parse_prefix")) {
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            for (int i = 1; i < line.argc(); i += 2) {
+                std::string_view key = line.argv[i] + 2;
+                const char * match = nullptr;
+                for (const char * name : flags.long_names) {
+                    if (strncmp(name, key.data(), key.size()) == 0) {
+                        if (match) {
+                            abort();
+                        }
+                        match = name;
+                    }
+                }
+                if (!match) {
+                    abort();
+                }
+            }
+        });
+        report("linear", "parse_prefix", flags.size(), line.argc() - 1, result);
+    }
+}
+
+// A misspelt long name, so parsing fails and looks for the closest names to suggest
+// The naive API computes the full edit distance matrix against every name, as a baseline
+static void bench_suggest(const bench_options& options, const flag_set& flags)
+{
+    std::string typo = std::string("--") + flags.long_names[flags.size() / 2];
+    std::swap(typo[3], typo[4]);
+
+    command_line line;
+    line.add("bench");
+    line.add(typo);
+    line.finish();
+
+    if (enabled(options, "schema", "suggest")) {
+        cflags::schema schema;
+        register_cpp(schema, flags);
+        cflags::result parsed;
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            if (schema.parse(line.argc(), line.argv.data(), parsed) || parsed.error.find("did you mean") == std::string::npos) {
+                abort();
+            }
+        });
+        report("schema", "suggest", flags.size(), line.argc() - 1, result);
+    }
+
+    if (enabled(options, "naive", "suggest")) {
+        std::string_view key = std::string_view(typo).substr(2);
+        std::vector<size_t> row(64);
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            size_t best = SIZE_MAX;
+            for (std::string_view name : flags.long_names) {
+                row.resize(name.size() + 1);
+                for (size_t j = 0; j <= name.size(); ++j) {
+                    row[j] = j;
+                }
+                for (size_t i = 1; i <= key.size(); ++i) {
+                    size_t diagonal = row[0];
+                    row[0] = i;
+                    for (size_t j = 1; j <= name.size(); ++j) {
+                        size_t above = row[j];
+                        row[j] = std::min({ above + 1, row[j - 1] + 1, diagonal + (key[i - 1] != name[j - 1]) });
+                        diagonal = above;
+                    }
+                }
+                best = std::min(best, row[name.size()]);
+            }
+            bench_checksum = bench_checksum + static_cast<double>(best);
+        });
+        report("naive", "suggest", flags.size(), line.argc() - 1, result);
+    }
+}
+
+// The candidates a completion script asks for as each character of a name is typed
+// parse() answers a request with these same calls and then returns, so they are measured without writing to stdout
+static void bench_complete(const bench_options& options, const flag_set& flags)
+{
+    std::string name = std::string("--") + flags.long_names[flags.size() / 2];
+    std::vector<std::string> words;
+    for (size_t i = 1; i <= name.size(); ++i) {
+        words.push_back(name.substr(0, i));
+    }
+
+    if (enabled(options, "c", "complete")) {
+        void * parser = bench_c_register_completion(flags.size(), flags.long_names.data(), flags.short_names.data());
+
+        // A partial @file under the cursor is answered as typed, and never read as a response file
+        command_line request;
+        request.add("bench");
+        request.add("--__complete");
+        request.add("@partial");
+        request.finish();
+        if (bench_c_parse(parser, request.argc(), request.argv.data()) || !bench_c_completed(parser)) {
+            abort();
+        }
+
+        auto result = measure(options, bench_c_allocations, [&]() {
+            size_t size = 0;
+            for (auto& word : words) {
+                size += bench_c_complete(parser, word.c_str());
+            }
+            bench_checksum = bench_checksum + static_cast<double>(size);
+        });
+        result.ns_per_op /= static_cast<double>(words.size());
+        result.allocs_per_op /= static_cast<double>(words.size());
+        bench_c_free(parser);
+        report("c", "complete", flags.size(), 1, result);
+    }
+
+    if (enabled(options, "cpp", "complete")) {
+        cflags::cflags parser;
+        parser.completion = true;
+        register_cpp(parser, flags);
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            size_t size = 0;
+            for (auto& word : words) {
+                const char * arg = word.c_str();
+                size += parser.complete(1, &arg).size();
+            }
+            bench_checksum = bench_checksum + static_cast<double>(size);
+        });
+        result.ns_per_op /= static_cast<double>(words.size());
+        result.allocs_per_op /= static_cast<double>(words.size());
+        report("cpp", "complete", flags.size(), 1, result);
+    }
+}
+
+// Help and schema queries repeated against the same flags, which are rendered once and then reused
+static void bench_format(const bench_options& options, const flag_set& flags)
+{
+    if (enabled(options, "c", "format")) {
+        void * parser = bench_c_register(flags.size(), flags.long_names.data(), flags.short_names.data());
+        auto result = measure(options, bench_c_allocations, [&]() {
+            bench_checksum = bench_checksum + static_cast<double>(bench_c_format(parser));
+        });
+        bench_c_free(parser);
+        report("c", "format", flags.size(), 0, result);
+    }
+
+    if (enabled(options, "cpp", "format")) {
+        cflags::cflags parser;
+        register_cpp(parser, flags);
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            size_t size = parser.format_usage("[OPTION]...", "Benchmark usage.", "", 100).size() + parser.format_schema().size();
+            bench_checksum = bench_checksum + static_cast<double>(size);
+        });
+        report("cpp", "format", flags.size(), 0, result);
+    }
+}
+
+// Many short command lines parsed against one schema, with an increasing number of threads
+// ns_per_op is per command line, so with perfect scaling it halves each time threads doubles
+static void bench_parse_many(const bench_options& options, const flag_set& flags, int line_count)
+{
+    if (!enabled(options, "schema", "parse_many")) {
+        return;
+    }
+
+    cflags::schema schema;
+    register_cpp(schema, flags);
+
+    // Each line is `bench --name value ... file`, NUL separated
+    std::vector<std::string> storage;
+    for (int i = 0; i < line_count; ++i) {
+        std::string line = "bench";
+        line += '\0';
+        for (int j = 0; j < 4; ++j) {
+            line += "--";
+            line += flags.long_names[(i * 31 + j * 7919) % flags.size()];
+            line += '\0';
+            line += std::to_string(i + j);
+            line += '\0';
+        }
+        line += "file-" + std::to_string(i) + ".txt";
+        line += '\0';
+        storage.push_back(std::move(line));
+    }
+    std::vector<std::string_view> lines(storage.begin(), storage.end());
+
+    unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; ; threads *= 2) {
+        threads = std::min(threads, max_threads);
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            for (auto& parsed : schema.parse_many(lines, threads)) {
+                if (!parsed) {
+                    abort();
+                }
+            }
+        });
+        result.ns_per_op /= line_count;
+        result.allocs_per_op /= line_count;
+        report("schema", "parse_many", flags.size(), line_count, result, threads);
+
+        if (threads == max_threads) {
+            break;
+        }
+    }
+}
+
+// A small tool's options, registered and parsed from scratch each time as on a cold start
+struct startup_options
+{
+    int threads = 1;
+    int port = 0;
+    float ratio = 0.0f;
+    bool verbose = false;
+    bool dry_run = false;
+    std::string_view name;
+    std::string output;
+    std::vector<int> ids;
+};
+
+static constexpr auto startup_schema = cflags::make_static_schema(
+    cflags::field('t', "threads", &startup_options::threads, "number of threads"),
+    cflags::field('p', "port", &startup_options::port, "port to listen on"),
+    cflags::field('\0', "ratio", &startup_options::ratio, "sampling ratio"),
+    cflags::field('v', "verbose", &startup_options::verbose, "enable verbose output"),
+    cflags::field('n', "dry-run", &startup_options::dry_run, "do not write anything"),
+    cflags::field('\0', "name", &startup_options::name, "name of the job"),
+    cflags::field('o', "output", &startup_options::output, "output path"),
+    cflags::field('\0', "ids", &startup_options::ids, "ids to process"));
+
+static command_line make_startup_args()
+{
+    command_line line;
+    for (const char * arg : { "bench", "-t", "8", "--port=8080", "--ratio", "0.25", "-vn", "--name=nightly", "-o", "out.txt", "--ids=1,2,3,4", "input.txt" }) {
+        line.add(arg);
+    }
+    line.finish();
+    return line;
+}
+
+// Registration and parsing together, the static API registers nothing at runtime
+static void bench_startup(const bench_options& options)
+{
+    auto line = make_startup_args();
+    int arg_count = line.argc() - 1;
+    int flag_count = static_cast<int>(startup_schema.size);
+
+    if (enabled(options, "cpp", "startup")) {
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            startup_options parsed;
+            const char * name = nullptr;
+            cflags::cflags parser;
+            parser.add_int('t', "threads", &parsed.threads, "number of threads");
+            parser.add_int('p', "port", &parsed.port, "port to listen on");
+            parser.add_float('\0', "ratio", &parsed.ratio, "sampling ratio");
+            parser.add_bool('v', "verbose", &parsed.verbose, "enable verbose output");
+            parser.add_bool('n', "dry-run", &parsed.dry_run, "do not write anything");
+            parser.add_cstring('\0', "name", &name, "name of the job");
+            parser.add_string('o', "output", &parsed.output, "output path");
+            parser.add_int_list('\0', "ids", &parsed.ids, "ids to process");
+            if (!parser.parse(line.argc(), line.argv.data()) || parsed.threads != 8) {
+                abort();
+            }
+        });
+        report("cpp", "startup", flag_count, arg_count, result);
+    }
+
+    if (enabled(options, "static", "startup")) {
+        std::vector<const char *> args;
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            startup_options parsed;
+            if (!startup_schema.parse(line.argc(), line.argv.data(), parsed, &args) || parsed.threads != 8) {
+                abort();
+            }
+        });
+        report("static", "startup", flag_count, arg_count, result);
+    }
+}
+
+// A multi-tool with command_count subcommands of flags_per_command int flags each, named "cmdC" and "cC-opt-I"
+struct command_set
+{
+    int command_count;
+    int flags_per_command;
+    std::vector<std::string> command_names;
+    std::vector<std::string> long_names;
+
+    command_set(int command_count, int flags_per_command)
+        : command_count(command_count)
+        , flags_per_command(flags_per_command)
+    {
+        for (int c = 0; c < command_count; ++c) {
+            command_names.push_back("cmd" + std::to_string(c));
+            for (int i = 0; i < flags_per_command; ++i) {
+                long_names.push_back("c" + std::to_string(c) + "-opt-" + std::to_string(i));
+            }
+        }
+    }
+
+    template <class Parser>
+    void register_command(Parser& parser, int command) const
+    {
+        for (int i = 0; i < flags_per_command; ++i) {
+            parser.add_int('\0', long_names[command * flags_per_command + i], &bench_cpp_values[i], "benchmark flag");
+        }
+    }
+};
+
+// The last command, with a few of its flags
+static command_line make_command_args(const command_set& commands, int arg_count)
+{
+    int command = commands.command_count - 1;
+    command_line line;
+    line.add("bench");
+    line.add(commands.command_names[command]);
+    for (int i = 0; i < arg_count / 2; ++i) {
+        line.add("--" + commands.long_names[command * commands.flags_per_command + (i * 7) % commands.flags_per_command]);
+        line.add("1");
+    }
+    line.finish();
+    return line;
+}
+
+// Registration and parsing together, as on a cold start of a multi-tool
+// Eager registers every command's flags in one flat set, lazy only sets up the command that is run
+static void bench_commands(const bench_options& options, const command_set& commands)
+{
+    auto line = make_command_args(commands, 16);
+    int arg_count = line.argc() - 1;
+    int flag_count = commands.command_count * commands.flags_per_command;
+
+    if (enabled(options, "cpp", "commands_eager")) {
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            cflags::cflags parser;
+            for (int c = 0; c < commands.command_count; ++c) {
+                commands.register_command(parser, c);
+            }
+            if (!parser.parse(line.argc(), line.argv.data())) {
+                abort();
+            }
+        });
+        report("cpp", "commands_eager", flag_count, arg_count, result);
+    }
+
+    if (enabled(options, "cpp", "commands_lazy")) {
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            cflags::cflags parser;
+            for (int c = 0; c < commands.command_count; ++c) {
+                parser.add_command(commands.command_names[c], [&commands, c](cflags::cflags& command) {
+                    commands.register_command(command, c);
+                }, "benchmark command");
+            }
+            if (!parser.parse(line.argc(), line.argv.data()) || !parser.command()) {
+                abort();
+            }
+        });
+        report("cpp", "commands_lazy", flag_count, arg_count, result);
+    }
+
+    // Completing a flag of a nested subcommand, as `bench cmdN nested --cN-opt-1<TAB>` would, setting up each command on the way
+    if (enabled(options, "cpp", "commands_complete")) {
+        int command = commands.command_count - 1;
+        std::string flag = "--" + commands.long_names[command * commands.flags_per_command + 1];
+        std::string expected = flag + "\n";
+        std::vector<const char *> words = { commands.command_names[command].c_str(), "nested", flag.c_str() };
+        std::vector<const char *> command_words = { "cmd1" };
+
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            cflags::cflags parser;
+            parser.completion = true;
+            for (int c = 0; c < commands.command_count; ++c) {
+                parser.add_command(commands.command_names[c], [&commands, c](cflags::cflags& command) {
+                    command.add_command("nested", [&commands, c](cflags::cflags& nested) {
+                        commands.register_command(nested, c);
+                    }, "nested benchmark command");
+                }, "benchmark command");
+            }
+            if (parser.complete(static_cast<int>(words.size()), words.data()).compare(0, expected.size(), expected) != 0 ||
+                parser.complete(1, command_words.data()).compare(0, 11, "cmd1\ncmd10\n") != 0) {
+                abort();
+            }
+        });
+        report("cpp", "commands_complete", flag_count, static_cast<int>(words.size()), result);
+    }
+}
+
+// Integers and decimals of varying length, as they might be given on a command line
+struct numeric_values
+{
+    std::vector<std::string> int_storage;
+    std::vector<std::string> float_storage;
+    std::vector<const char *> ints;
+    std::vector<const char *> floats;
+
+    explicit numeric_values(int count)
+    {
+        char buffer[32];
+        for (int i = 0; i < count; ++i) {
+            int_storage.push_back(std::to_string((i * 104729) % 2000000 - 1000000));
+            snprintf(buffer, sizeof(buffer), "%.*f", i % 6, ((i * 7919) % 100000) / 64.0);
+            float_storage.push_back(buffer);
+        }
+        for (int i = 0; i < count; ++i) {
+            ints.push_back(int_storage[i].c_str());
+            floats.push_back(float_storage[i].c_str());
+        }
+    }
+
+    int size() const
+    {
+        return static_cast<int>(ints.size());
+    }
+};
+
+// Raw conversion throughput, the libc API is the previous strtol/strtof path
+static void bench_convert(const bench_options& options, const numeric_values& values)
+{
+    if (enabled(options, "c", "convert_int")) {
+        auto result = measure(options, bench_c_allocations, [&]() {
+            bench_checksum = bench_checksum + static_cast<double>(bench_c_convert_int(values.ints.data(), values.size()));
+        });
+        report("c", "convert_int", 0, values.size(), result);
+    }
+
+    if (enabled(options, "c", "convert_float")) {
+        auto result = measure(options, bench_c_allocations, [&]() {
+            bench_checksum = bench_checksum + bench_c_convert_float(values.floats.data(), values.size());
+        });
+        report("c", "convert_float", 0, values.size(), result);
+    }
+
+    if (enabled(options, "cpp", "convert_int")) {
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            long long sum = 0;
+            for (auto value : values.ints) {
+                int converted = 0;
+                if (cflags::from_string(value, converted)) {
+                    abort();
+                }
+                sum += converted;
+            }
+            bench_checksum = bench_checksum + static_cast<double>(sum);
+        });
+        report("cpp", "convert_int", 0, values.size(), result);
+    }
+
+    if (enabled(options, "cpp", "convert_float")) {
+        auto result = measure(options, bench_cpp_allocations, [&]() {
+            double sum = 0.0;
+            for (auto value : values.floats) {
+                float converted = 0.0f;
+                if (cflags::from_string(value, converted)) {
+                    abort();
+                }
+                sum += converted;
+            }
+            bench_checksum = bench_checksum + sum;
+        });
+        report("cpp", "convert_float", 0, values.size(), result);
+    }
+
+    if (enabled(options, "libc", "convert_int")) {
+        auto result = measure(options, bench_c_allocations, [&]() {
+            bench_checksum = bench_checksum + static_cast<double>(bench_libc_convert_int(values.ints.data(), values.size()));
+        });
+        report("libc", "convert_int", 0, values.size(), result);
+    }
+
+    if (enabled(options, "libc", "convert_float")) {
+        auto result = measure(options, bench_c_allocations, [&]() {
+            bench_checksum = bench_checksum + bench_libc_convert_float(values.floats.data(), values.size());
+        });
+        report("libc", "convert_float", 0, values.size(), result);
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    bench_options options;
+
+    cflags::cflags flags;
+
+    bool help = false;
+    flags.add_bool('\0', "help", &help, "display this help and exit");
+    flags.add_bool('q', "quick", &options.quick, "run a reduced sweep with shorter timings");
+    flags.add_string('a', "api", &options.api, "only run benchmarks for this API: c, cpp, lazy, schema, static, linear, naive, libc, or all");
+    flags.add_string('f', "filter", &options.filter, "only run benchmarks whose name contains this string");
+
+    if (!flags.parse(argc, argv) || help) {
+        flags.print_usage(
+            "[OPTION]...",
+            "Benchmark flag registration and parsing for the C and C++ APIs.",
+            "Results are printed as one JSON object per line.");
+        return (help ? 0 : 1);
+    }
+
+    if (options.quick) {
+        options.min_time_ms = 5.0;
+    }
+
+    std::vector<int> flag_counts = { 10, 100, 1000, 10000 };
+    std::vector<int> arg_counts = { 16, 256 };
+    std::vector<int> positional_counts = { 256, 50000 };
+    std::vector<int> list_counts = { 16, 50000 };
+    if (options.quick) {
+        flag_counts = { 10, 1000 };
+        arg_counts = { 16 };
+        positional_counts = { 256 };
+        list_counts = { 16 };
+    }
+
+    for (int flag_count : flag_counts) {
+        flag_set set(flag_count);
+
+        bench_register(options, set);
+
+        for (int arg_count : arg_counts) {
+            auto long_line = make_long_args(set, arg_count);
+            bench_parse(options, "parse_long", set, long_line);
+
+            auto short_line = make_short_args(set, arg_count);
+            bench_parse(options, "parse_short", set, short_line);
+
+            if (set.size() > set.short_count()) {
+                auto numeric_line = make_numeric_args(set, arg_count);
+                bench_parse(options, "parse_numeric", set, numeric_line);
+            }
+        }
+    }
+
+    flag_set set(flag_counts.front());
+    for (int arg_count : positional_counts) {
+        auto line = make_positional_args(arg_count);
+        bench_parse(options, "parse_positional", set, line);
+    }
+
+    // Names end in "-option", and are given as "-opt"
+    for (int flag_count : flag_counts) {
+        flag_set prefix_set(flag_count, "-option");
+        if (prefix_set.size() > prefix_set.short_count()) {
+            auto line = make_prefix_args(prefix_set, arg_counts.front(), 4);
+            bench_parse_prefix(options, prefix_set, line);
+        }
+    }
+
+    for (int flag_count : flag_counts) {
+        bench_suggest(options, flag_set(flag_count));
+    }
+
+    bench_format(options, flag_set(100));
+
+    for (int flag_count : flag_counts) {
+        bench_complete(options, flag_set(flag_count));
+    }
+
+    flag_set many_set(flag_counts.back());
+    bench_parse_many(options, many_set, (options.quick ? 10000 : 100000));
+
+    for (int element_count : list_counts) {
+        auto line = make_list_args(element_count);
+        bench_parse_list(options, element_count, line);
+    }
+
+    bench_startup(options);
+
+    bench_commands(options, command_set(20, 50));
+
+    numeric_values values(options.quick ? 256 : 4096);
+    bench_convert(options, values);
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef CFLAGS_BENCH_H
+#define CFLAGS_BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BENCH_MAX_FLAGS 10000
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+// Implemented in bench_c.c, so the C API is benchmarked as compiled by a C compiler
+
+size_t bench_c_allocations(void);
+
+void * bench_c_register(int flag_count, const char * const * long_names, const char * short_names);
+
+bool bench_c_parse(void * flags, int argc, char ** argv);
+
+void bench_c_free(void * flags);
+
+// As bench_c_register(), with prefix_matching set
+void * bench_c_register_prefix(int flag_count, const char * const * long_names, const char * short_names);
+
+// Render usage text at a fixed width, and the JSON schema, returning their total length
+size_t bench_c_format(void * flags);
+
+// As bench_c_register(), with completion and expand_response_files set
+void * bench_c_register_completion(int flag_count, const char * const * long_names, const char * short_names);
+
+// Whether the last bench_c_parse() answered a completion request
+bool bench_c_completed(void * flags);
+
+// Find the completions for word, as --__complete would print them, returning their total length
+size_t bench_c_complete(void * flags, const char * word);
+
+// A single int list flag named "ids"
+void * bench_c_register_list(void);
+
+// Convert every value and return a checksum, so the conversions cannot be optimized away
+// The cflags versions use the bundled parser, the libc versions use strtol/strtof
+
+long long bench_c_convert_int(const char * const * values, int count);
+
+double bench_c_convert_float(const char * const * values, int count);
+
+long long bench_libc_convert_int(const char * const * values, int count);
+
+double bench_libc_convert_float(const char * const * values, int count);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+#endif // CFLAGS_BENCH_H
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <stddef.h>
+
+static size_t bench_c_allocation_count = 0;
+
+static void * bench_c_malloc(size_t size)
+{
+    ++bench_c_allocation_count;
+    return malloc(size);
+}
+
+static void * bench_c_calloc(size_t count, size_t size)
+{
+    ++bench_c_allocation_count;
+    return calloc(count, size);
+}
+
+static void * bench_c_realloc(void * ptr, size_t size)
+{
+    ++bench_c_allocation_count;
+    return realloc(ptr, size);
+}
+
+#define CFLAGS_MALLOC(size)         bench_c_malloc(size)
+#define CFLAGS_CALLOC(count, size)  bench_c_calloc(count, size)
+#define CFLAGS_REALLOC(ptr, size)   bench_c_realloc(ptr, size)
+#define CFLAGS_FREE(ptr)            free(ptr)
+
+#include "cflags.h"
+
+#include "bench.h"
+
+static int bench_c_values[BENCH_MAX_FLAGS];
+
+size_t bench_c_allocations(void)
+{
+    return bench_c_allocation_count;
+}
+
+static void * bench_c_create(int flag_count, const char * const * long_names, const char * short_names, bool prefix_matching, bool completion)
+{
+    cflags_t * flags = cflags_init();
+    flags->prefix_matching = prefix_matching;
+    flags->completion = completion;
+    flags->expand_response_files = completion;
+    for (int i = 0; i < flag_count; ++i) {
+        if (short_names[i] != '\0') {
+            cflags_add_bool(flags, short_names[i], long_names[i], NULL, "benchmark flag");
+        }
+        else {
+            cflags_add_int(flags, '\0', long_names[i], &bench_c_values[i], "benchmark flag");
+        }
+    }
+    cflags_freeze(flags);
+    return flags;
+}
+
+void * bench_c_register(int flag_count, const char * const * long_names, const char * short_names)
+{
+    return bench_c_create(flag_count, long_names, short_names, false, false);
+}
+
+void * bench_c_register_prefix(int flag_count, const char * const * long_names, const char * short_names)
+{
+    return bench_c_create(flag_count, long_names, short_names, true, false);
+}
+
+void * bench_c_register_completion(int flag_count, const char * const * long_names, const char * short_names)
+{
+    return bench_c_create(flag_count, long_names, short_names, false, true);
+}
+
+static cflags_buffer_t bench_c_completions;
+
+size_t bench_c_complete(void * flags, const char * word)
+{
+    bench_c_completions.size = 0;
+    if (!_cflags_format_completions((cflags_t *)flags, word, &bench_c_completions)) {
+        abort();
+    }
+    return bench_c_completions.size;
+}
+
+bool bench_c_parse(void * flags, int argc, char ** argv)
+{
+    return cflags_parse((cflags_t *)flags, argc, argv);
+}
+
+bool bench_c_completed(void * flags)
+{
+    return ((cflags_t *)flags)->completed;
+}
+
+static cflags_int_list_t bench_c_list;
+
+void * bench_c_register_list(void)
+{
+    cflags_t * flags = cflags_init();
+    cflags_add_int_list(flags, '\0', "ids", &bench_c_list, "benchmark list");
+    cflags_freeze(flags);
+    return flags;
+}
+
+size_t bench_c_format(void * flags)
+{
+    const char * usage = cflags_format_usage((cflags_t *)flags, "[OPTION]...", "Benchmark usage.", "", 100);
+    const char * schema = cflags_format_schema((cflags_t *)flags);
+    if (!usage || !schema) {
+        abort();
+    }
+    return strlen(usage) + strlen(schema);
+}
+
+void bench_c_free(void * flags)
+{
+    free(bench_c_completions.data);
+    bench_c_completions.data = NULL;
+    bench_c_completions.capacity = 0;
+
+    cflags_free((cflags_t *)flags);
+}
+
+long long bench_c_convert_int(const char * const * values, int count)
+{
+    long long sum = 0;
+    for (int i = 0; i < count; ++i) {
+        int value = 0;
+        if (_cflags_parse_int(values[i], strlen(values[i]), &value)) {
+            abort();
+        }
+        sum += value;
+    }
+    return sum;
+}
+
+double bench_c_convert_float(const char * const * values, int count)
+{
+    double sum = 0.0;
+    for (int i = 0; i < count; ++i) {
+        float value = 0.0f;
+        if (_cflags_parse_float(values[i], strlen(values[i]), &value)) {
+            abort();
+        }
+        sum += value;
+    }
+    return sum;
+}
+
+long long bench_libc_convert_int(const char * const * values, int count)
+{
+    long long sum = 0;
+    for (int i = 0; i < count; ++i) {
+        sum += strtol(values[i], NULL, 10);
+    }
+    return sum;
+}
+
+double bench_libc_convert_float(const char * const * values, int count)
+{
+    double sum = 0.0;
+    for (int i = 0; i < count; ++i) {
+        sum += strtof(values[i], NULL);
+    }
+    return sum;
+}
@@ -28,9 +28,28 @@
 #define CFLAGS_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <limits.h>
+#include <float.h>
+#include <math.h>
+
+#if defined(CFLAGS_STATS)
+    #include <time.h>
+#endif
+
+#if !defined(_WIN32)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/ioctl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+
+    #define CFLAGS_HAVE_MMAP
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -38,6 +57,21 @@ extern "C" {
 
 #define CFLAGS_ERROR_OOM "cflags: out of memory"
 
+// Define these before including cflags.h to use a custom allocator
+#if !defined(CFLAGS_MALLOC)
+    #define CFLAGS_MALLOC(size)         malloc(size)
+    #define CFLAGS_CALLOC(count, size)  calloc(count, size)
+    #define CFLAGS_REALLOC(ptr, size)   realloc(ptr, size)
+    #define CFLAGS_FREE(ptr)            free(ptr)
+#endif
+
+#if defined(_WIN32)
+    #define CFLAGS_ENVIRON _environ
+#else
+    extern char ** environ;
+    #define CFLAGS_ENVIRON environ
+#endif
+
 enum cflags_type
 {
     CFLAGS_TYPE_UNDEFINED = -1,
@@ -45,6 +79,9 @@ enum cflags_type
     CFLAGS_TYPE_BOOL,
     CFLAGS_TYPE_INT,
     CFLAGS_TYPE_FLOAT,
+    CFLAGS_TYPE_STRING_LIST,
+    CFLAGS_TYPE_INT_LIST,
+    CFLAGS_TYPE_FLOAT_LIST,
     CFLAGS_TYPE_STRING_CALLBACK,
     CFLAGS_TYPE_BOOL_CALLBACK,
     CFLAGS_TYPE_INT_CALLBACK,
@@ -53,22 +90,122 @@ enum cflags_type
 
 typedef enum cflags_type cflags_type_t;
 
+// Define CFLAGS_STATS before including cflags.h to collect statistics while loading and parsing
+// Timing uses clock_gettime(), so strict ISO C builds also need _POSIX_C_SOURCE >= 199309L
+// When it is not defined the counters do not exist, and collecting them costs nothing
+#if defined(CFLAGS_STATS)
+    #define CFLAGS_STAT(statement) statement
+#else
+    #define CFLAGS_STAT(statement)
+#endif
+
+#if defined(CFLAGS_STATS)
+
+struct cflags_flag_stats
+{
+    // Times a lookup by name resolved to this flag
+    unsigned lookups;
+
+    // Time spent in this flag's callback
+    unsigned long long callback_ns;
+};
+
+typedef struct cflags_flag_stats cflags_flag_stats_t;
+
+// Accumulated until cflags_reset_stats()
+struct cflags_stats
+{
+    // Hash table slots examined, and names compared, while looking up flags
+    unsigned long long probes;
+    unsigned long long comparisons;
+
+    // Every heap allocation made by cflags_freeze(), parsing, and loading files
+    // Rendering usage, the schema, or completions is not counted
+    unsigned long long allocations;
+    unsigned long long bytes_copied;
+
+    unsigned long long callbacks;
+
+    // Time spent in user callbacks, and the rest of the time spent in cflags_parse*()
+    unsigned long long callback_ns;
+    unsigned long long library_ns;
+};
+
+typedef struct cflags_stats cflags_stats_t;
+
+#endif // CFLAGS_STATS
+
+// Targets for list flags, e.g. `--ids=1,2,3`
+// The values are stored in a single allocation owned by cflags, which is reused by later
+// parses and released by cflags_free(), so a list must outlive the cflags_t it is added to
+
+struct cflags_string_list
+{
+    // Each value is a terminated copy of one element
+    const char ** values;
+    size_t count;
+
+    size_t allocated;
+};
+
+typedef struct cflags_string_list cflags_string_list_t;
+
+struct cflags_int_list
+{
+    int * values;
+    size_t count;
+
+    size_t allocated;
+};
+
+typedef struct cflags_int_list cflags_int_list_t;
+
+struct cflags_float_list
+{
+    float * values;
+    size_t count;
+
+    size_t allocated;
+};
+
+typedef struct cflags_float_list cflags_float_list_t;
+
 struct cflags_flag
 {
     char            short_name;
+
+    // Separates the elements of list flags, '\0' is treated as ','
+    char            delimiter;
+
     const char *    long_name;
     const char *    description;
 
     cflags_type_t   type;
     unsigned        count;
 
+    // Environment variable to read this flag from, see cflags_bind_env()
+    const char *    env_name;
+
+    // Computed by cflags_freeze()
+    size_t          long_name_len;
+    uint32_t        long_name_hash;
+    uint32_t        env_name_hash;
+
     struct cflags_flag * next;
 
+#if defined(CFLAGS_STATS)
+    cflags_flag_stats_t stats;
+#endif
+
     union {
         const char **   string_ptr;
         bool *          bool_ptr;
         int *           int_ptr;
         float *         float_ptr;
+
+        cflags_string_list_t *  string_list_ptr;
+        cflags_int_list_t *     int_list_ptr;
+        cflags_float_list_t *   float_list_ptr;
     };
     
     void (*string_callback)(const char *);
@@ -79,21 +216,197 @@ struct cflags_flag
 
 typedef struct cflags_flag cflags_flag_t;
 
+// CFLAGS_DEFINE_*(name, short_name, default_value, description) defines a flag from any translation unit as
+// a global FLAGS_name, with the long name "name", and CFLAGS_DECLARE_*(name) declares it for use elsewhere
+// Each definition is a constant cflags_flag_t in the cflags_flags section, which the linker gathers into one
+// table between __start_cflags_flags and __stop_cflags_flags, so defining a flag costs nothing before main()
+// cflags_add_static_flags() adds the table to a set of flags, which only then accepts them
+#if defined(__ELF__) && defined(__GNUC__)
+    #define CFLAGS_HAVE_SECTIONS
+
+    extern const cflags_flag_t __start_cflags_flags[] __attribute__((weak, visibility("hidden")));
+    extern const cflags_flag_t __stop_cflags_flags[] __attribute__((weak, visibility("hidden")));
+
+    // Aligned explicitly, as the compiler may over-align large objects and leave gaps in the table
+    #define _CFLAGS_DEFINE(c_type, flag_type, member, name, short_name_, default_value, description_)     \
+        c_type FLAGS_##name = default_value;                                                                \
+        static const cflags_flag_t _cflags_definition_##name                                               \
+            __attribute__((used, section("cflags_flags"), aligned(__alignof__(cflags_flag_t)))) = {         \
+            .short_name = short_name_, .delimiter = ',', .long_name = #name, .description = description_,   \
+            .type = flag_type, .member = &FLAGS_##name }
+
+    #define CFLAGS_DEFINE_STRING(name, short_name, default_value, description) \
+        _CFLAGS_DEFINE(const char *, CFLAGS_TYPE_STRING, string_ptr, name, short_name, default_value, description)
+    #define CFLAGS_DEFINE_BOOL(name, short_name, default_value, description) \
+        _CFLAGS_DEFINE(bool, CFLAGS_TYPE_BOOL, bool_ptr, name, short_name, default_value, description)
+    #define CFLAGS_DEFINE_INT(name, short_name, default_value, description) \
+        _CFLAGS_DEFINE(int, CFLAGS_TYPE_INT, int_ptr, name, short_name, default_value, description)
+    #define CFLAGS_DEFINE_FLOAT(name, short_name, default_value, description) \
+        _CFLAGS_DEFINE(float, CFLAGS_TYPE_FLOAT, float_ptr, name, short_name, default_value, description)
+#endif
+
+#define CFLAGS_DECLARE_STRING(name) extern const char * FLAGS_##name
+#define CFLAGS_DECLARE_BOOL(name)   extern bool FLAGS_##name
+#define CFLAGS_DECLARE_INT(name)    extern int FLAGS_##name
+#define CFLAGS_DECLARE_FLOAT(name)  extern float FLAGS_##name
+
+// Flags are stored in contiguous blocks that are never moved, so the pointers
+// returned by cflags_add_*() remain valid until cflags_free()
+struct cflags_flag_block
+{
+    struct cflags_flag_block * next;
+    size_t capacity;
+    size_t size;
+
+    // Followed by `capacity` cflags_flag_t in the same allocation
+};
+
+typedef struct cflags_flag_block cflags_flag_block_t;
+
+#define CFLAGS_FLAG_BLOCK_MIN_CAPACITY 16
+
+// Identifies a file and the version of its contents, so that an unchanged file can be recognized
+// Every field is zero where files cannot be identified
+struct cflags_file_id
+{
+    unsigned long long device;
+    unsigned long long inode;
+    unsigned long long size;
+    unsigned long long modified_ns;
+};
+
+typedef struct cflags_file_id cflags_file_id_t;
+
+// A token of a response file, with a NULL flag, or a flag and value read from a config file
+struct cflags_mapping_entry
+{
+    cflags_flag_t * flag;
+    const char *    value;
+};
+
+typedef struct cflags_mapping_entry cflags_mapping_entry_t;
+
+// The contents of a file, either mapped with mmap() or read into memory
+// Arguments parsed from the file point into `data`, so it lives until cflags_free()
+// Once the whole file has been read it is `complete`, and loading it again while it is unchanged
+// reuses its entries instead of mapping it again
+struct cflags_mapping
+{
+    struct cflags_mapping * next;
+
+    char *  data;
+    size_t  size;
+    bool    mapped;
+
+    cflags_file_id_t id;
+    bool    config;
+    bool    complete;
+
+    cflags_mapping_entry_t * entries;
+    size_t  entry_count;
+    size_t  entry_capacity;
+};
+
+typedef struct cflags_mapping cflags_mapping_t;
+
+#define CFLAGS_RESPONSE_FILE_MAX_DEPTH 32
+
+// Suggestions are at most 3 edits from a pattern cut to 64 characters, so longer names are never suggested
+#define CFLAGS_SUGGESTION_MAX_LEN (64 + 3)
+
+// A long name in the table of suggestion candidates built by cflags_freeze()
+// `shared` is how many leading characters it has in common with the name before it of the same length
+struct cflags_suggestion
+{
+    const char *    name;
+    unsigned        order;
+    unsigned char   len;
+    unsigned char   shared;
+};
+
+typedef struct cflags_suggestion cflags_suggestion_t;
+
+// A growable block of text, used to render usage and the schema once and write them in a single call
+struct cflags_buffer
+{
+    char *  data;
+    size_t  size;
+    size_t  capacity;
+};
+
+typedef struct cflags_buffer cflags_buffer_t;
+
 struct cflags
 {
     const char * program;
 
-    int     argc;
-    char ** argv;
+    int             argc;
+    const char **   argv;
+
+    // false when argv points to a buffer supplied to cflags_parse_buffer()
+    bool    argv_owned;
+
+    // Replace @file arguments with the arguments read from the file
+    bool            expand_response_files;
+    const char **   response_argv;
+
+    // Accept any unambiguous prefix of a long name on the command line, such as --verb for --verbose
+    // Set this before cflags_freeze(), which builds the index it needs
+    bool            prefix_matching;
+
+    // Answer the hidden --__complete and --__complete-script arguments used by shell completion
+    // Set this before cflags_freeze(), as completion uses the same index as prefix_matching
+    bool            completion;
+
+    // Set when parsing answered a completion request instead, and returned false without parsing anything
+    bool            completed;
+
+    cflags_mapping_t * mappings;
 
     cflags_flag_t * first_flag;
+    cflags_flag_t * last_flag;
+
+    cflags_flag_block_t * first_block;
+    cflags_flag_block_t * last_block;
+
+    // Prefix for environment variables named after each flag, see cflags_set_env_prefix()
+    const char * env_prefix;
+
+    // Lookup tables built by cflags_freeze()
+    bool            frozen;
+    size_t          long_index_mask;
+    cflags_flag_t ** long_index;
+    cflags_flag_t * short_index[256];
+    cflags_flag_t ** env_index;
+
+    // Flags sorted by long name, only built when prefix_matching or completion is set
+    size_t          prefix_index_size;
+    cflags_flag_t ** prefix_index;
+
+    // Long names grouped by length and sorted within each group, so suggestions only scan similar lengths
+    // The names of length n are from suggestion_offsets[n] up to suggestion_offsets[n + 1]
+    cflags_suggestion_t * suggestions;
+    size_t          suggestion_offsets[CFLAGS_SUGGESTION_MAX_LEN + 2];
+
+    // Rendered by cflags_format_usage() and cflags_format_schema(), and kept until cflags_freeze() runs again
+    bool            usage_valid;
+    size_t          usage_width;
+    cflags_buffer_t usage_table;
+    cflags_buffer_t usage_text;
+
+    bool            schema_valid;
+    cflags_buffer_t schema_text;
+
+#if defined(CFLAGS_STATS)
+    cflags_stats_t stats;
+#endif
 };
 
 typedef struct cflags cflags_t;
 
 static cflags_t * cflags_init()
 {
-    cflags_t * flags = (cflags_t *)malloc(sizeof(cflags_t));
+    cflags_t * flags = (cflags_t *)CFLAGS_MALLOC(sizeof(cflags_t));
     if (!flags) {
         fprintf(stderr, CFLAGS_ERROR_OOM);
         return NULL;
@@ -102,33 +415,164 @@ static cflags_t * cflags_init()
     flags->program = NULL;
     flags->argc = 0;
     flags->argv = NULL;
+    flags->argv_owned = false;
+    flags->expand_response_files = false;
+    flags->response_argv = NULL;
+    flags->prefix_matching = false;
+    flags->completion = false;
+    flags->completed = false;
+    flags->mappings = NULL;
+    flags->env_prefix = NULL;
     flags->first_flag = NULL;
+    flags->last_flag = NULL;
+    flags->first_block = NULL;
+    flags->last_block = NULL;
+    flags->frozen = false;
+    flags->long_index_mask = 0;
+    flags->long_index = NULL;
+    memset(flags->short_index, 0, sizeof(flags->short_index));
+    flags->env_index = NULL;
+    flags->prefix_index_size = 0;
+    flags->prefix_index = NULL;
+    flags->suggestions = NULL;
+    memset(flags->suggestion_offsets, 0, sizeof(flags->suggestion_offsets));
+    flags->usage_valid = false;
+    flags->usage_width = 0;
+    memset(&flags->usage_table, 0, sizeof(cflags_buffer_t));
+    memset(&flags->usage_text, 0, sizeof(cflags_buffer_t));
+    flags->schema_valid = false;
+    memset(&flags->schema_text, 0, sizeof(cflags_buffer_t));
+    CFLAGS_STAT(memset(&flags->stats, 0, sizeof(flags->stats)));
     return flags;
 }
 
-cflags_flag_t * _cflags_add_flag(cflags_t * flags)
+#if defined(CFLAGS_STATS)
+
+static unsigned long long _cflags_now_ns(void)
+{
+    struct timespec ts;
+#if defined(_WIN32)
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+#endif // CFLAGS_STATS
+
+static cflags_flag_t * _cflags_flag_block_data(cflags_flag_block_t * block)
+{
+    return (cflags_flag_t *)(block + 1);
+}
+
+// Reserve `count` contiguous flags, allocating a new block only when the last one is full
+static cflags_flag_t * _cflags_allocate_flags(cflags_t * flags, size_t count)
 {
-    cflags_flag_t ** next_flag = &flags->first_flag;
+    cflags_flag_block_t * block = flags->last_block;
+    if (!block || block->capacity - block->size < count) {
+        size_t capacity = CFLAGS_FLAG_BLOCK_MIN_CAPACITY;
+        if (block) {
+            capacity = block->capacity * 2;
+        }
+        if (capacity < count) {
+            capacity = count;
+        }
 
-    while (*next_flag) {
-        next_flag = &(*next_flag)->next;
+        block = (cflags_flag_block_t *)CFLAGS_MALLOC(sizeof(cflags_flag_block_t) + capacity * sizeof(cflags_flag_t));
+        if (!block) {
+            fprintf(stderr, CFLAGS_ERROR_OOM);
+            return NULL;
+        }
+        CFLAGS_STAT(++flags->stats.allocations);
+
+        block->next = NULL;
+        block->capacity = capacity;
+        block->size = 0;
+
+        if (flags->last_block) {
+            flags->last_block->next = block;
+        }
+        else {
+            flags->first_block = block;
+        }
+        flags->last_block = block;
     }
 
-    *next_flag = (cflags_flag_t *)malloc(sizeof(cflags_flag_t));
-    if (!*next_flag) {
-        fprintf(stderr, CFLAGS_ERROR_OOM);
+    cflags_flag_t * first = _cflags_flag_block_data(block) + block->size;
+    block->size += count;
+    return first;
+}
+
+// Append `count` contiguous flags to the end of the list
+static void _cflags_link_flags(cflags_t * flags, cflags_flag_t * first, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        first[i].count = 0;
+        first[i].long_name_len = 0;
+        first[i].long_name_hash = 0;
+        first[i].env_name_hash = 0;
+        CFLAGS_STAT(memset(&first[i].stats, 0, sizeof(first[i].stats)));
+        first[i].next = (i + 1 < count ? &first[i + 1] : NULL);
+    }
+
+    if (flags->last_flag) {
+        flags->last_flag->next = first;
+    }
+    else {
+        flags->first_flag = first;
+    }
+    flags->last_flag = &first[count - 1];
+
+    flags->frozen = false;
+}
+
+static cflags_flag_t * _cflags_add_flag(cflags_t * flags)
+{
+    cflags_flag_t * flag = _cflags_allocate_flags(flags, 1);
+    if (!flag) {
+        return NULL;
+    }
+
+    flag->short_name = '\0';
+    flag->delimiter = ',';
+    flag->long_name = NULL;
+    flag->type = CFLAGS_TYPE_UNDEFINED;
+    flag->description = NULL;
+    flag->env_name = NULL;
+
+    _cflags_link_flags(flags, flag, 1);
+    return flag;
+}
+
+// Register a table of flags with at most one allocation
+// The entries are copied, and a pointer to the first of `count` contiguous flags is returned
+static cflags_flag_t * cflags_add_flags(cflags_t * flags, const cflags_flag_t * table, size_t count)
+{
+    if (count == 0) {
+        return NULL;
+    }
+
+    cflags_flag_t * first = _cflags_allocate_flags(flags, count);
+    if (!first) {
         return NULL;
     }
 
-    (*next_flag)->short_name = '\0';
-    (*next_flag)->long_name = NULL;
-    (*next_flag)->type = CFLAGS_TYPE_UNDEFINED;
-    (*next_flag)->count = 0;
-    (*next_flag)->description = NULL;
-    (*next_flag)->next = NULL;
+    memcpy(first, table, count * sizeof(cflags_flag_t));
+    CFLAGS_STAT(flags->stats.bytes_copied += count * sizeof(cflags_flag_t));
+    _cflags_link_flags(flags, first, count);
+    return first;
+}
 
-    return *next_flag;
+#if defined(CFLAGS_HAVE_SECTIONS)
+// Add every flag defined with CFLAGS_DEFINE_*() in the program, with at most one allocation
+// Returns false if out of memory
+static bool cflags_add_static_flags(cflags_t * flags)
+{
+    size_t count = (size_t)(__stop_cflags_flags - __start_cflags_flags);
+    return (count == 0 || cflags_add_flags(flags, __start_cflags_flags, count) != NULL);
 }
+#endif
 
 static cflags_flag_t * cflags_add_string(cflags_t * flags, char short_name, const char * long_name, const char ** value, const char * description)
 {
@@ -250,252 +694,2302 @@ static cflags_flag_t * cflags_add_float_callback(cflags_t * flags, char short_na
     return flag;
 }
 
-static bool _cflags_parse_bool(const char * str)
+// The list is emptied, and its values replaced each time the flag is processed
+static cflags_flag_t * cflags_add_string_list(cflags_t * flags, char short_name, const char * long_name, cflags_string_list_t * list, const char * description)
 {
-    return !(strcmp(str, "false") == 0 ||
-            strcmp(str, "FALSE") == 0 ||
-            strcmp(str, "0") == 0);
+    cflags_flag_t * flag = _cflags_add_flag(flags);
+    if (!flag) {
+        return NULL;
+    }
+
+    memset(list, 0, sizeof(*list));
+
+    flag->short_name = short_name;
+    flag->long_name = long_name;
+    flag->type = CFLAGS_TYPE_STRING_LIST;
+    flag->string_list_ptr = list;
+    flag->description = description;
+    return flag;
 }
 
-static void _cflags_process_flag(cflags_flag_t * flag, const char * value)
+static cflags_flag_t * cflags_add_int_list(cflags_t * flags, char short_name, const char * long_name, cflags_int_list_t * list, const char * description)
 {
-    ++flag->count;
-
-    switch (flag->type) {
-    case CFLAGS_TYPE_STRING:
-        if (flag->string_ptr) {
-            *flag->string_ptr = value;
-        }
-        break;
-    case CFLAGS_TYPE_STRING_CALLBACK:
-        if (flag->string_callback) {
-            flag->string_callback(value);
-        }
-        break;
-    case CFLAGS_TYPE_BOOL:
-        if (flag->bool_ptr) {
-            if (value) {
-                *flag->bool_ptr = _cflags_parse_bool(value);
-            }
-            else {
-                *flag->bool_ptr = true;
-            }
-        }
-        break;
-    case CFLAGS_TYPE_BOOL_CALLBACK:
-        if (flag->bool_callback) {
-            if (value) {
-                flag->bool_callback(_cflags_parse_bool(value));
-            }
-            else {
-                flag->bool_callback(true);
-            }
-        }
-        break;
-    case CFLAGS_TYPE_INT:
-        if (flag->int_ptr) {
-            if (value) {
-                *flag->int_ptr = strtol(value, NULL, 10);
-            }
-        }
-        break;
-    case CFLAGS_TYPE_INT_CALLBACK:
-        if (flag->int_callback) {
-            if (value) {
-                flag->int_callback(strtol(value, NULL, 10));
-            }
-        }
-        break;
-    case CFLAGS_TYPE_FLOAT:
-        if (flag->float_ptr) {
-            if (value) {
-                *flag->float_ptr = strtof(value, NULL);
-            }
-        }
-        break;
-    case CFLAGS_TYPE_FLOAT_CALLBACK:
-        if (flag->float_callback) {
-            if (value) {
-                flag->float_callback(strtof(value, NULL));
-            }
-        }
-        break;
-    default: ;
+    cflags_flag_t * flag = _cflags_add_flag(flags);
+    if (!flag) {
+        return NULL;
     }
+
+    memset(list, 0, sizeof(*list));
+
+    flag->short_name = short_name;
+    flag->long_name = long_name;
+    flag->type = CFLAGS_TYPE_INT_LIST;
+    flag->int_list_ptr = list;
+    flag->description = description;
+    return flag;
 }
 
-static bool cflags_parse(cflags_t * flags, int argc, char ** argv)
+static cflags_flag_t * cflags_add_float_list(cflags_t * flags, char short_name, const char * long_name, cflags_float_list_t * list, const char * description)
 {
-    flags->argc = 1;
-    flags->argv = (char **)malloc(flags->argc * sizeof(char *));
-    if (!flags->argv) {
-        fprintf(stderr, CFLAGS_ERROR_OOM);
-        return false;
+    cflags_flag_t * flag = _cflags_add_flag(flags);
+    if (!flag) {
+        return NULL;
     }
-    flags->argv[0] = argv[0];
-    flags->program = flags->argv[0];
 
-    bool passthrough = false;
-    for (int i = 1; i < argc; ++i) {
-        char * pch = argv[i];
-        if (!passthrough && *pch == '-') {
-            ++pch;
-            if (*pch == '-') {
-                ++pch;
+    memset(list, 0, sizeof(*list));
 
-                if (*pch == '\0') {
-                    // All following flags are not to be processed
-                    passthrough = true;
-                    continue;
-                }
-                
-                // Long
-                char * key = pch;
-                char * value = NULL;
+    flag->short_name = short_name;
+    flag->long_name = long_name;
+    flag->type = CFLAGS_TYPE_FLOAT_LIST;
+    flag->float_list_ptr = list;
+    flag->description = description;
+    return flag;
+}
 
-                char * divider = strchr(pch, '=');
-                if (divider) {
-                    *divider = '\0';
-                    value = divider + 1;
-                }
+// FNV-1a
+static uint32_t _cflags_hash_update(uint32_t hash, const char * str, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-                bool next_arg_is_value = (i + 1 < argc && argv[i + 1][0] != '-');
+static uint32_t _cflags_hash(const char * str, size_t len)
+{
+    return _cflags_hash_update(2166136261u, str, len);
+}
 
-                bool found = false;
-                cflags_flag_t * flag = flags->first_flag;
-                while (flag) {
-                    if (strcmp(flag->long_name, key) == 0) {
-                        found = true;
+// Read a flag's value from an environment variable, which is applied before any arguments
+static void cflags_bind_env(cflags_t * flags, cflags_flag_t * flag, const char * env_name)
+{
+    flag->env_name = env_name;
+    flags->frozen = false;
+}
 
-                        if (value) {
-                            _cflags_process_flag(flag, value);
-                        }
-                        else if (next_arg_is_value) {
-                            _cflags_process_flag(flag, argv[i + 1]);
-                            ++i;
-                        }
-                        else if (flag->type == CFLAGS_TYPE_BOOL || flag->type == CFLAGS_TYPE_BOOL_CALLBACK) {
-                            _cflags_process_flag(flag, NULL);
-                        }
-                        else {
-                            fprintf(stderr, "%s: option '--%s' requires an value\n", flags->program, key);
-                            return false;
-                        }
+// Read every flag with a long name from an environment variable named `prefix` followed by the
+// long name in uppercase with '-' replaced by '_', e.g. "APP_" and "log-level" become APP_LOG_LEVEL
+// Flags bound with cflags_bind_env() use that name instead
+static void cflags_set_env_prefix(cflags_t * flags, const char * prefix)
+{
+    flags->env_prefix = prefix;
+    flags->frozen = false;
+}
 
-                        break;
-                    }
+static char _cflags_env_char(char c)
+{
+    return (c == '-' ? '_' : (char)toupper((unsigned char)c));
+}
 
-                    flag = flag->next;
-                }
+// Returns false if the flag is not bound to an environment variable
+static bool _cflags_env_hash(cflags_t * flags, cflags_flag_t * flag, uint32_t * hash)
+{
+    if (flag->env_name) {
+        *hash = _cflags_hash(flag->env_name, strlen(flag->env_name));
+        return true;
+    }
 
-                if (!found) {
-                    fprintf(stderr, "%s: unrecognized option '--%s'\n", flags->program, key);
-                    return false;
-                }
-            }
-            else {
+    if (flags->env_prefix && flag->long_name) {
+        *hash = _cflags_hash(flags->env_prefix, strlen(flags->env_prefix));
+        for (size_t i = 0; i < flag->long_name_len; ++i) {
+            char c = _cflags_env_char(flag->long_name[i]);
+            *hash = _cflags_hash_update(*hash, &c, 1);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+static bool _cflags_env_name_equals(cflags_t * flags, cflags_flag_t * flag, const char * name, size_t len)
+{
+    if (flag->env_name) {
+        return (strlen(flag->env_name) == len && memcmp(flag->env_name, name, len) == 0);
+    }
+
+    size_t prefix_len = strlen(flags->env_prefix);
+    if (prefix_len + flag->long_name_len != len || memcmp(flags->env_prefix, name, prefix_len) != 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < flag->long_name_len; ++i) {
+        if (_cflags_env_char(flag->long_name[i]) != name[prefix_len + i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool _cflags_buffer_reserve(cflags_buffer_t * buffer, size_t extra)
+{
+    if (buffer->size + extra <= buffer->capacity) {
+        return true;
+    }
+
+    size_t capacity = (buffer->capacity > 0 ? buffer->capacity * 2 : 1024);
+    while (capacity < buffer->size + extra) {
+        capacity *= 2;
+    }
+
+    char * data = (char *)CFLAGS_REALLOC(buffer->data, capacity);
+    if (!data) {
+        fprintf(stderr, CFLAGS_ERROR_OOM);
+        return false;
+    }
+
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
+
+static bool _cflags_buffer_append(cflags_buffer_t * buffer, const char * str, size_t len)
+{
+    if (!_cflags_buffer_reserve(buffer, len)) {
+        return false;
+    }
+    memcpy(buffer->data + buffer->size, str, len);
+    buffer->size += len;
+    return true;
+}
+
+static bool _cflags_buffer_append_string(cflags_buffer_t * buffer, const char * str)
+{
+    return _cflags_buffer_append(buffer, str, (str ? strlen(str) : 0));
+}
+
+static bool _cflags_buffer_fill(cflags_buffer_t * buffer, char c, size_t count)
+{
+    if (!_cflags_buffer_reserve(buffer, count)) {
+        return false;
+    }
+    memset(buffer->data + buffer->size, c, count);
+    buffer->size += count;
+    return true;
+}
+
+// Write all of `data` to stdout in as few calls as the system allows, after anything already buffered
+static void _cflags_write_stdout(const char * data, size_t size)
+{
+    fflush(stdout);
+
+#if !defined(_WIN32)
+    while (size > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, size);
+        if (written <= 0) {
+            break;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+#else
+    fwrite(data, 1, size, stdout);
+    fflush(stdout);
+#endif
+}
+
+static int _cflags_compare_long_names(const void * lhs, const void * rhs)
+{
+    return strcmp((*(cflags_flag_t * const *)lhs)->long_name, (*(cflags_flag_t * const *)rhs)->long_name);
+}
+
+static int _cflags_compare_suggestions(const void * lhs, const void * rhs)
+{
+    const cflags_suggestion_t * a = (const cflags_suggestion_t *)lhs;
+    const cflags_suggestion_t * b = (const cflags_suggestion_t *)rhs;
+    return (a->len != b->len ? (int)a->len - (int)b->len : strcmp(a->name, b->name));
+}
+
+// Sort the suggestion candidates by length and then name, and find where each length starts
+static void _cflags_sort_suggestions(cflags_t * flags, size_t count)
+{
+    qsort(flags->suggestions, count, sizeof(cflags_suggestion_t), _cflags_compare_suggestions);
+
+    memset(flags->suggestion_offsets, 0, sizeof(flags->suggestion_offsets));
+    for (size_t i = 0; i < count; ++i) {
+        ++flags->suggestion_offsets[flags->suggestions[i].len + 1];
+    }
+    for (size_t len = 1; len < CFLAGS_SUGGESTION_MAX_LEN + 2; ++len) {
+        flags->suggestion_offsets[len] += flags->suggestion_offsets[len - 1];
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        cflags_suggestion_t * suggestion = &flags->suggestions[i];
+        suggestion->shared = 0;
+        if (i > 0 && flags->suggestions[i - 1].len == suggestion->len) {
+            const char * previous = flags->suggestions[i - 1].name;
+            while (previous[suggestion->shared] == suggestion->name[suggestion->shared]) {
+                ++suggestion->shared;
+            }
+        }
+    }
+}
+
+// Build open-addressing hash tables of long names and environment variables, and a table of short names
+// This is called automatically by cflags_parse(), and again whenever a flag is added
+static bool cflags_freeze(cflags_t * flags)
+{
+    size_t flag_count = 0;
+    bool use_env = (flags->env_prefix != NULL);
+    cflags_flag_t * flag = flags->first_flag;
+    while (flag) {
+        ++flag_count;
+        use_env = use_env || (flag->env_name != NULL);
+        flag = flag->next;
+    }
+
+    // Keep the load factor at or below 0.5, so most lookups take a single probe
+    size_t capacity = 16;
+    while (capacity < flag_count * 2) {
+        capacity *= 2;
+    }
+
+    bool use_prefix = ((flags->prefix_matching || flags->completion) && flag_count > 0);
+
+    bool use_suggestions = (flag_count > 0);
+
+    CFLAGS_FREE(flags->long_index);
+    CFLAGS_FREE(flags->env_index);
+    CFLAGS_FREE(flags->prefix_index);
+    CFLAGS_FREE(flags->suggestions);
+    flags->long_index = (cflags_flag_t **)CFLAGS_CALLOC(capacity, sizeof(cflags_flag_t *));
+    flags->env_index = (use_env ? (cflags_flag_t **)CFLAGS_CALLOC(capacity, sizeof(cflags_flag_t *)) : NULL);
+    flags->prefix_index = (use_prefix ? (cflags_flag_t **)CFLAGS_MALLOC(flag_count * sizeof(cflags_flag_t *)) : NULL);
+    flags->prefix_index_size = 0;
+    flags->suggestions = (use_suggestions ? (cflags_suggestion_t *)CFLAGS_MALLOC(flag_count * sizeof(cflags_suggestion_t)) : NULL);
+    if (!flags->long_index || (use_env && !flags->env_index) || (use_prefix && !flags->prefix_index) || (use_suggestions && !flags->suggestions)) {
+        fprintf(stderr, CFLAGS_ERROR_OOM);
+        CFLAGS_FREE(flags->long_index);
+        CFLAGS_FREE(flags->env_index);
+        CFLAGS_FREE(flags->prefix_index);
+        CFLAGS_FREE(flags->suggestions);
+        flags->long_index = NULL;
+        flags->env_index = NULL;
+        flags->prefix_index = NULL;
+        flags->suggestions = NULL;
+        flags->long_index_mask = 0;
+        flags->frozen = false;
+        return false;
+    }
+    flags->long_index_mask = capacity - 1;
+    memset(flags->short_index, 0, sizeof(flags->short_index));
+    CFLAGS_STAT(flags->stats.allocations += 1 + (use_env ? 1 : 0) + (use_prefix ? 1 : 0) + (use_suggestions ? 1 : 0));
+
+    size_t suggestion_count = 0;
+
+    // The first flag registered with a given name wins
+    flag = flags->first_flag;
+    while (flag) {
+        if (flag->long_name) {
+            flag->long_name_len = strlen(flag->long_name);
+            flag->long_name_hash = _cflags_hash(flag->long_name, flag->long_name_len);
+
+            size_t index = flag->long_name_hash & flags->long_index_mask;
+            while (flags->long_index[index]) {
+                cflags_flag_t * other = flags->long_index[index];
+                if (other->long_name_hash == flag->long_name_hash &&
+                    other->long_name_len == flag->long_name_len &&
+                    memcmp(other->long_name, flag->long_name, flag->long_name_len) == 0) {
+                    break;
+                }
+                index = (index + 1) & flags->long_index_mask;
+            }
+
+            // Only the flag that wins each name is a prefix or suggestion candidate
+            if (!flags->long_index[index]) {
+                flags->long_index[index] = flag;
+                if (use_prefix) {
+                    flags->prefix_index[flags->prefix_index_size++] = flag;
+                }
+                if (flag->long_name_len > 0 && flag->long_name_len <= CFLAGS_SUGGESTION_MAX_LEN) {
+                    cflags_suggestion_t * suggestion = &flags->suggestions[suggestion_count];
+                    suggestion->name = flag->long_name;
+                    suggestion->order = (unsigned)suggestion_count;
+                    suggestion->len = (unsigned char)flag->long_name_len;
+                    ++suggestion_count;
+                }
+            }
+        }
+
+        if (use_env && _cflags_env_hash(flags, flag, &flag->env_name_hash)) {
+            size_t index = flag->env_name_hash & flags->long_index_mask;
+            while (flags->env_index[index]) {
+                index = (index + 1) & flags->long_index_mask;
+            }
+            flags->env_index[index] = flag;
+        }
+
+        unsigned char short_index = (unsigned char)flag->short_name;
+        if (short_index != '\0' && !flags->short_index[short_index]) {
+            flags->short_index[short_index] = flag;
+        }
+
+        flag = flag->next;
+    }
+
+    if (use_prefix) {
+        qsort(flags->prefix_index, flags->prefix_index_size, sizeof(cflags_flag_t *), _cflags_compare_long_names);
+    }
+    _cflags_sort_suggestions(flags, suggestion_count);
+
+    // Flags are only added or changed while unfrozen, so anything rendered before now may be stale
+    flags->usage_valid = false;
+    flags->schema_valid = false;
+
+    flags->frozen = true;
+    return true;
+}
+
+static cflags_flag_t * _cflags_find_long(cflags_t * flags, const char * name, size_t len)
+{
+    uint32_t hash = _cflags_hash(name, len);
+
+    size_t index = hash & flags->long_index_mask;
+    CFLAGS_STAT(++flags->stats.probes);
+    while (flags->long_index[index]) {
+        cflags_flag_t * flag = flags->long_index[index];
+        if (flag->long_name_hash == hash && flag->long_name_len == len) {
+            CFLAGS_STAT(++flags->stats.comparisons);
+            if (memcmp(flag->long_name, name, len) == 0) {
+                CFLAGS_STAT(++flag->stats.lookups);
+                return flag;
+            }
+        }
+        index = (index + 1) & flags->long_index_mask;
+        CFLAGS_STAT(++flags->stats.probes);
+    }
+
+    return NULL;
+}
+
+// Binary search the sorted long names for the first one starting with `name`, which need not be terminated
+static size_t _cflags_prefix_lower_bound(cflags_t * flags, const char * name, size_t len)
+{
+    size_t first = 0;
+    size_t last = flags->prefix_index_size;
+    while (first < last) {
+        size_t middle = first + (last - first) / 2;
+        CFLAGS_STAT(++flags->stats.comparisons);
+        if (strncmp(flags->prefix_index[middle]->long_name, name, len) < 0) {
+            first = middle + 1;
+        }
+        else {
+            last = middle;
+        }
+    }
+    return first;
+}
+
+// Returns the only long name starting with `name`, or NULL with `*ambiguous` set to the first of several matches
+static cflags_flag_t * _cflags_find_prefix(cflags_t * flags, const char * name, size_t len, cflags_flag_t *** ambiguous)
+{
+    *ambiguous = NULL;
+
+    size_t first = _cflags_prefix_lower_bound(flags, name, len);
+
+    if (first == flags->prefix_index_size || strncmp(flags->prefix_index[first]->long_name, name, len) != 0) {
+        return NULL;
+    }
+
+    if (first + 1 < flags->prefix_index_size && strncmp(flags->prefix_index[first + 1]->long_name, name, len) == 0) {
+        *ambiguous = &flags->prefix_index[first];
+        return NULL;
+    }
+
+    CFLAGS_STAT(++flags->prefix_index[first]->stats.lookups);
+    return flags->prefix_index[first];
+}
+
+static void _cflags_print_ambiguous(cflags_t * flags, const char * name, size_t len, cflags_flag_t ** candidates)
+{
+    cflags_flag_t ** end = flags->prefix_index + flags->prefix_index_size;
+
+    fprintf(stderr, "%s: option '--%.*s' is ambiguous; possibilities:", flags->program, (int)len, name);
+    for (; candidates < end && strncmp((*candidates)->long_name, name, len) == 0; ++candidates) {
+        fprintf(stderr, " '--%s'", (*candidates)->long_name);
+    }
+    fprintf(stderr, "\n");
+}
+
+// A column of Myers' bit-parallel edit distance, in Hyyrö's formulation, between a pattern of up to 64 characters
+// and the first characters of a name, where bit i of `pv` or `mv` is set if row i + 1 is one more or one less than row i
+// Each character of the name costs a handful of word operations, rather than a column of the full matrix
+struct _cflags_edit_column
+{
+    uint64_t    pv;
+    uint64_t    mv;
+    size_t      distance;
+};
+
+// Extend a column by one character of the name, where `eq` has a bit for each position of that character in the pattern
+static struct _cflags_edit_column _cflags_edit_step(struct _cflags_edit_column column, uint64_t eq, uint64_t last)
+{
+    uint64_t xv = eq | column.mv;
+    uint64_t xh = (((eq & column.pv) + column.pv) ^ column.pv) | eq;
+    uint64_t ph = column.mv | ~(xh | column.pv);
+    uint64_t mh = column.pv & xh;
+
+    if (ph & last) {
+        ++column.distance;
+    }
+    else if (mh & last) {
+        --column.distance;
+    }
+
+    // The first row counts insertions, so it grows by one for every character of the name
+    ph = (ph << 1) | 1;
+    mh <<= 1;
+    column.pv = mh | ~(xv | ph);
+    column.mv = ph & xv;
+    return column;
+}
+
+// The smallest row of the column after `depth` characters, which bounds the distance of every name starting with them
+static size_t _cflags_edit_lowest(const struct _cflags_edit_column * column, size_t depth, size_t pattern_len)
+{
+    size_t row = depth;
+    size_t lowest = depth;
+    for (size_t i = 0; i < pattern_len && lowest > 0; ++i) {
+        row = row + ((column->pv >> i) & 1) - ((column->mv >> i) & 1);
+        lowest = (row < lowest ? row : lowest);
+    }
+    return lowest;
+}
+
+#define CFLAGS_MAX_SUGGESTIONS 3
+
+// A search for the closest long names, which first finds the smallest distance and then collects the names at it
+struct _cflags_suggest
+{
+    uint64_t    peq[256];
+    size_t      pattern_len;
+    size_t      best;
+    bool        collect;
+
+    const cflags_suggestion_t * found[CFLAGS_MAX_SUGGESTIONS];
+    size_t      found_count;
+};
+
+static bool _cflags_suggest_within(const struct _cflags_suggest * search, size_t distance)
+{
+    return (search->collect ? distance <= search->best : distance < search->best);
+}
+
+static void _cflags_suggest_visit(struct _cflags_suggest * search, const cflags_suggestion_t * suggestion, size_t distance)
+{
+    if (!search->collect) {
+        search->best = (distance < search->best ? distance : search->best);
+        return;
+    }
+    if (distance != search->best) {
+        return;
+    }
+
+    // Keep the names registered first, in the order they were registered
+    size_t i = search->found_count;
+    if (i == CFLAGS_MAX_SUGGESTIONS) {
+        if (search->found[i - 1]->order < suggestion->order) {
+            return;
+        }
+        --i;
+    }
+    else {
+        ++search->found_count;
+    }
+    for (; i > 0 && search->found[i - 1]->order > suggestion->order; --i) {
+        search->found[i] = search->found[i - 1];
+    }
+    search->found[i] = suggestion;
+}
+
+// The end of the names from `first` that start with the `len` characters of `prefix`, where the name before `first` does
+// Names are sorted, so the run is found by galloping and then a binary search, and a short run stays cheap
+static size_t _cflags_suggest_skip(const cflags_suggestion_t * suggestions, size_t first, size_t end, const char * prefix, size_t len)
+{
+    if (first == end || suggestions[first].shared < len) {
+        return first;
+    }
+
+    size_t low = first + 1;
+    size_t high = end;
+    for (size_t step = 1; low < end; step *= 2) {
+        size_t probe = (low + step - 1 < end - 1 ? low + step - 1 : end - 1);
+        if (memcmp(suggestions[probe].name, prefix, len) != 0) {
+            high = probe;
+            break;
+        }
+        low = probe + 1;
+    }
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (memcmp(suggestions[middle].name, prefix, len) == 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Visit every name of length `len` that its prefix does not rule out
+// Names sharing a prefix are next to each other, so the columns of the shared characters are kept from the name before,
+// and a prefix is abandoned, with every name that starts with it, once no row of its column is within reach
+static void _cflags_suggest_scan(cflags_t * flags, struct _cflags_suggest * search, size_t len)
+{
+    const cflags_suggestion_t * suggestions = flags->suggestions;
+    size_t end = flags->suggestion_offsets[len + 1];
+    uint64_t last = (uint64_t)1 << (search->pattern_len - 1);
+
+    struct _cflags_edit_column columns[CFLAGS_SUGGESTION_MAX_LEN + 1];
+    columns[0].pv = ~(uint64_t)0;
+    columns[0].mv = 0;
+    columns[0].distance = search->pattern_len;
+    size_t valid = 0;
+
+    for (size_t i = flags->suggestion_offsets[len]; i < end;) {
+        const cflags_suggestion_t * suggestion = &suggestions[i++];
+        size_t depth = (suggestion->shared < valid ? suggestion->shared : valid);
+        bool reachable = true;
+        while (depth < len && reachable) {
+            columns[depth + 1] = _cflags_edit_step(columns[depth], search->peq[(unsigned char)suggestion->name[depth]], last);
+            ++depth;
+            reachable = _cflags_suggest_within(search, _cflags_edit_lowest(&columns[depth], depth, search->pattern_len));
+        }
+        valid = depth;
+
+        if (reachable) {
+            _cflags_suggest_visit(search, suggestion, columns[len].distance);
+        }
+        else {
+            i = _cflags_suggest_skip(suggestions, i, end, suggestion->name, depth);
+        }
+    }
+}
+
+// Finish an "unrecognized option" message with the closest long names, if any are close enough
+static void _cflags_print_suggestions(cflags_t * flags, const char * dashes, const char * name, size_t len)
+{
+    struct _cflags_suggest search;
+
+    // Only the first 64 characters fit in a word, which is more than any real flag name
+    search.pattern_len = (len < 64 ? len : 64);
+    size_t max_distance = (search.pattern_len / 3 > 3 ? 3 : (search.pattern_len / 3 < 1 ? 1 : search.pattern_len / 3));
+
+    // A suggestion must be within max_distance, and closer than retyping the whole name
+    size_t limit = (max_distance + 1 < search.pattern_len ? max_distance + 1 : search.pattern_len);
+    search.best = limit;
+    search.collect = false;
+    search.found_count = 0;
+
+    if (flags->suggestions && search.pattern_len > 1) {
+        memset(search.peq, 0, sizeof(search.peq));
+        for (size_t i = 0; i < search.pattern_len; ++i) {
+            search.peq[(unsigned char)name[i]] |= (uint64_t)1 << i;
+        }
+
+        // Lengths nearest the pattern's are scanned first, as a close name found early abandons more prefixes
+        for (size_t offset = 0; offset < search.best; ++offset) {
+            if (offset < search.pattern_len) {
+                _cflags_suggest_scan(flags, &search, search.pattern_len - offset);
+            }
+            if (offset > 0 && offset < search.best && search.pattern_len + offset <= CFLAGS_SUGGESTION_MAX_LEN) {
+                _cflags_suggest_scan(flags, &search, search.pattern_len + offset);
+            }
+        }
+
+        if (search.best < limit) {
+            search.collect = true;
+            size_t first = (search.pattern_len > search.best ? search.pattern_len - search.best : 1);
+            for (size_t name_len = first; name_len <= search.pattern_len + search.best && name_len <= CFLAGS_SUGGESTION_MAX_LEN; ++name_len) {
+                _cflags_suggest_scan(flags, &search, name_len);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < search.found_count; ++i) {
+        fprintf(stderr, "%s'%s%s'", (i == 0 ? "; did you mean " : ", "), dashes, search.found[i]->name);
+    }
+    fprintf(stderr, "%s\n", (search.found_count > 0 ? "?" : ""));
+}
+
+// Append every long name starting with `word` to `buffer`, one per line, for a completion script to offer
+// Words that do not start with '-' get no candidates, so the shell falls back to completing files
+static bool _cflags_format_completions(cflags_t * flags, const char * word, cflags_buffer_t * buffer)
+{
+    if (word[0] != '-') {
+        return true;
+    }
+    const char * name = word + (word[1] == '-' ? 2 : 1);
+    size_t len = strlen(name);
+
+    for (size_t i = _cflags_prefix_lower_bound(flags, name, len); i < flags->prefix_index_size; ++i) {
+        const char * long_name = flags->prefix_index[i]->long_name;
+        if (strncmp(long_name, name, len) != 0) {
+            break;
+        }
+        if (!_cflags_buffer_append(buffer, "--", 2) ||
+            !_cflags_buffer_append_string(buffer, long_name) ||
+            !_cflags_buffer_append(buffer, "\n", 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool _cflags_complete(cflags_t * flags, const char * word)
+{
+    cflags_buffer_t buffer = { NULL, 0, 0 };
+    bool formatted = _cflags_format_completions(flags, word, &buffer);
+    if (formatted) {
+        _cflags_write_stdout(buffer.data, buffer.size);
+    }
+    CFLAGS_FREE(buffer.data);
+    return formatted;
+}
+
+// Each script calls the program with --__complete and the word under the cursor
+// @NAME@ is replaced with the program's name, and @FUNC@ with the same name made safe for a shell function
+static const char * _cflags_completion_script(const char * shell)
+{
+    if (strcmp(shell, "bash") == 0) {
+        return
+            "_@FUNC@_complete() {\n"
+            "    local cur=\"${COMP_WORDS[COMP_CWORD]}\"\n"
+            "    COMPREPLY=($(compgen -W \"$(\"${COMP_WORDS[0]}\" --__complete \"$cur\" 2>/dev/null)\" -- \"$cur\"))\n"
+            "}\n"
+            "complete -o default -F _@FUNC@_complete @NAME@\n";
+    }
+    if (strcmp(shell, "zsh") == 0) {
+        return
+            "#compdef @NAME@\n"
+            "_@FUNC@_complete() {\n"
+            "    local -a candidates\n"
+            "    candidates=(${(f)\"$(\"${words[1]}\" --__complete \"${words[CURRENT]}\" 2>/dev/null)\"})\n"
+            "    if (( ${#candidates} )); then\n"
+            "        compadd -- $candidates\n"
+            "    else\n"
+            "        _files\n"
+            "    fi\n"
+            "}\n"
+            "compdef _@FUNC@_complete @NAME@\n";
+    }
+    if (strcmp(shell, "fish") == 0) {
+        return "complete -c @NAME@ -a '(@NAME@ --__complete (commandline -ct) 2>/dev/null)'\n";
+    }
+    return NULL;
+}
+
+static bool _cflags_print_completion_script(cflags_t * flags, const char * program, const char * shell)
+{
+    const char * script = _cflags_completion_script(shell);
+    if (!script) {
+        fprintf(stderr, "%s: unsupported shell '%s', expected bash, zsh, or fish\n", flags->program, shell);
+        return false;
+    }
+
+    const char * slash = strrchr(program, '/');
+    const char * name = (slash ? slash + 1 : program);
+    size_t name_len = strlen(name);
+
+    cflags_buffer_t buffer = { NULL, 0, 0 };
+    for (const char * pch = script; *pch; ++pch) {
+        bool appended = true;
+        if (strncmp(pch, "@NAME@", 6) == 0) {
+            appended = _cflags_buffer_append(&buffer, name, name_len);
+            pch += 5;
+        }
+        else if (strncmp(pch, "@FUNC@", 6) == 0) {
+            for (size_t i = 0; i < name_len && appended; ++i) {
+                char c = (isalnum((unsigned char)name[i]) ? name[i] : '_');
+                appended = _cflags_buffer_append(&buffer, &c, 1);
+            }
+            pch += 5;
+        }
+        else {
+            appended = _cflags_buffer_append(&buffer, pch, 1);
+        }
+
+        if (!appended) {
+            fprintf(stderr, CFLAGS_ERROR_OOM);
+            CFLAGS_FREE(buffer.data);
+            return false;
+        }
+    }
+
+    _cflags_write_stdout(buffer.data, buffer.size);
+    CFLAGS_FREE(buffer.data);
+    return true;
+}
+
+// Answer a completion request from the flag index alone, without applying any flag or calling any callback
+// Returns true if argv was a completion request, and sets `completed` if it was answered
+static bool _cflags_handle_completion(cflags_t * flags, int argc, const char * const * argv)
+{
+    if (strcmp(argv[1], "--__complete") == 0) {
+        // Only the last word is completed, as there are no subcommands for the words before it to select
+        flags->completed = _cflags_complete(flags, (argc > 2 ? argv[argc - 1] : ""));
+        return true;
+    }
+    if (strcmp(argv[1], "--__complete-script") == 0) {
+        flags->completed = _cflags_print_completion_script(flags, argv[0], (argc > 2 ? argv[2] : "bash"));
+        return true;
+    }
+    return false;
+}
+
+static cflags_flag_t * _cflags_find_short(cflags_t * flags, char short_name)
+{
+    cflags_flag_t * flag = flags->short_index[(unsigned char)short_name];
+    CFLAGS_STAT(++flags->stats.probes);
+    CFLAGS_STAT(if (flag) { ++flag->stats.lookups; });
+    return flag;
+}
+
+static bool _cflags_parse_bool(const char * str)
+{
+    return !(strcmp(str, "false") == 0 ||
+            strcmp(str, "FALSE") == 0 ||
+            strcmp(str, "0") == 0);
+}
+
+// Numeric values are converted with a bundled decimal parser instead of strtol/strtof, so the
+// result does not depend on the current locale and the whole value must be a valid number
+// Values are length-delimited, so list elements can be converted without being terminated
+// Each conversion returns NULL on success, or a short description of why the value was rejected
+
+#define _CFLAGS_IS_DIGIT(pch, end) ((pch) < (end) && (unsigned)(*(pch) - '0') <= 9)
+
+static const char * _cflags_parse_int(const char * str, size_t len, int * out)
+{
+    const char * pch = str;
+    const char * end = str + len;
+    bool negative = (pch < end && *pch == '-');
+    if (pch < end && (*pch == '-' || *pch == '+')) {
+        ++pch;
+    }
+
+    if (!_CFLAGS_IS_DIGIT(pch, end)) {
+        return "expected an integer";
+    }
+
+    unsigned long long limit = (negative ? (unsigned long long)INT_MAX + 1 : (unsigned long long)INT_MAX);
+    unsigned long long value = 0;
+    bool overflow = false;
+    while (_CFLAGS_IS_DIGIT(pch, end)) {
+        value = value * 10 + (unsigned)(*pch - '0');
+        if (value > limit) {
+            overflow = true;
+            value = limit;
+        }
+        ++pch;
+    }
+
+    if (pch != end) {
+        return "expected an integer";
+    }
+    if (overflow) {
+        return "out of range";
+    }
+
+    *out = (negative ? (int)(-(long long)value) : (int)value);
+    return NULL;
+}
+
+static bool _cflags_equals_ignore_case(const char * str, size_t len, const char * lower)
+{
+    if (len != strlen(lower)) {
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        if ((str[i] | 0x20) != lower[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every power of ten up to 1e22 is exactly representable as a double
+static const double _cflags_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static const char * _cflags_parse_float(const char * str, size_t len, float * out)
+{
+    const char * pch = str;
+    const char * end = str + len;
+    bool negative = (pch < end && *pch == '-');
+    if (pch < end && (*pch == '-' || *pch == '+')) {
+        ++pch;
+    }
+
+    size_t rest = (size_t)(end - pch);
+    if (_cflags_equals_ignore_case(pch, rest, "inf") || _cflags_equals_ignore_case(pch, rest, "infinity")) {
+        *out = (negative ? -HUGE_VALF : HUGE_VALF);
+        return NULL;
+    }
+    if (_cflags_equals_ignore_case(pch, rest, "nan")) {
+        *out = NAN;
+        return NULL;
+    }
+
+    // Up to 19 significant digits fit in the mantissa, the rest only move the exponent
+    uint64_t mantissa = 0;
+    int significant = 0;
+    int exponent = 0;
+    bool has_digits = false;
+
+    while (_CFLAGS_IS_DIGIT(pch, end)) {
+        unsigned digit = (unsigned)(*pch - '0');
+        if (significant < 19) {
+            if (mantissa > 0 || digit > 0) {
+                mantissa = mantissa * 10 + digit;
+                ++significant;
+            }
+        }
+        else {
+            ++exponent;
+        }
+        has_digits = true;
+        ++pch;
+    }
+
+    if (pch < end && *pch == '.') {
+        ++pch;
+        while (_CFLAGS_IS_DIGIT(pch, end)) {
+            unsigned digit = (unsigned)(*pch - '0');
+            if (significant < 19) {
+                if (mantissa > 0 || digit > 0) {
+                    mantissa = mantissa * 10 + digit;
+                    ++significant;
+                }
+                --exponent;
+            }
+            has_digits = true;
+            ++pch;
+        }
+    }
+
+    if (!has_digits) {
+        return "expected a number";
+    }
+
+    if (pch < end && (*pch == 'e' || *pch == 'E')) {
+        ++pch;
+        bool negative_exponent = (pch < end && *pch == '-');
+        if (pch < end && (*pch == '-' || *pch == '+')) {
+            ++pch;
+        }
+
+        if (!_CFLAGS_IS_DIGIT(pch, end)) {
+            return "expected a number";
+        }
+
+        int value = 0;
+        while (_CFLAGS_IS_DIGIT(pch, end)) {
+            if (value < 100000) {
+                value = value * 10 + (*pch - '0');
+            }
+            ++pch;
+        }
+        exponent += (negative_exponent ? -value : value);
+    }
+
+    if (pch != end) {
+        return "expected a number";
+    }
+
+    double value = 0.0;
+    if (mantissa > 0) {
+        // Outside of these bounds the result is certain to overflow or underflow a float
+        if (exponent > 60 || exponent < -80) {
+            return "out of range";
+        }
+
+        // With a mantissa below 2^53 and a power of ten that is exact, a single multiply or
+        // divide is correctly rounded, this covers nearly every value given on a command line
+        value = (double)mantissa;
+        while (exponent > 22) {
+            value *= _cflags_pow10[22];
+            exponent -= 22;
+        }
+        while (exponent < -22) {
+            value /= _cflags_pow10[22];
+            exponent += 22;
+        }
+        if (exponent < 0) {
+            value /= _cflags_pow10[-exponent];
+        }
+        else {
+            value *= _cflags_pow10[exponent];
+        }
+
+        // Halfway between FLT_MAX and 2^128 already rounds to infinity
+        if (value >= 0x1.ffffffp127 || (float)value == 0.0f) {
+            return "out of range";
+        }
+    }
+
+    *out = (float)(negative ? -value : value);
+    return NULL;
+}
+
+static size_t _cflags_count_char(const char * str, size_t len, char c)
+{
+    size_t count = 0;
+    const char * end = str + len;
+    while ((str = (const char *)memchr(str, c, (size_t)(end - str)))) {
+        ++count;
+        ++str;
+    }
+    return count;
+}
+
+// Returns storage for a list of at least `size` bytes, reusing `values` when it is already large enough
+static void * _cflags_reserve_list(cflags_t * flags, void * values, size_t * allocated, size_t size)
+{
+    if (size <= *allocated) {
+        return values;
+    }
+
+    void * tmp = CFLAGS_REALLOC(values, size);
+    if (tmp) {
+        *allocated = size;
+        CFLAGS_STAT(++flags->stats.allocations);
+    }
+#if !defined(CFLAGS_STATS)
+    (void)flags;
+#endif
+    return tmp;
+}
+
+// The delimiters are counted first, so the storage is allocated at most once,
+// then each element is found with memchr() and converted in place
+static const char * _cflags_process_list(cflags_t * flags, cflags_flag_t * flag, const char * value)
+{
+    char delimiter = (flag->delimiter ? flag->delimiter : ',');
+    size_t len = strlen(value);
+    size_t count = (len > 0 ? _cflags_count_char(value, len, delimiter) + 1 : 0);
+
+    const char * pch = value;
+    const char * end = value + len;
+
+    switch (flag->type) {
+    case CFLAGS_TYPE_STRING_LIST: {
+        cflags_string_list_t * list = flag->string_list_ptr;
+        list->count = 0;
+
+        // The pointers are followed by a copy of the value, with each delimiter replaced by '\0'
+        size_t size = count * sizeof(const char *) + len + 1;
+        const char ** values = (const char **)_cflags_reserve_list(flags, list->values, &list->allocated, size);
+        if (!values) {
+            return "out of memory";
+        }
+        list->values = values;
+
+        char * copy = (char *)(list->values + count);
+        memcpy(copy, value, len + 1);
+
+        for (size_t i = 0; i < count; ++i) {
+            const char * next = (const char *)memchr(pch, delimiter, (size_t)(end - pch));
+            if (!next) {
+                next = end;
+            }
+            copy[next - value] = '\0';
+            list->values[i] = copy + (pch - value);
+            pch = next + 1;
+        }
+        list->count = count;
+        break;
+    }
+    case CFLAGS_TYPE_INT_LIST: {
+        cflags_int_list_t * list = flag->int_list_ptr;
+        list->count = 0;
+
+        if (count > 0) {
+            int * values = (int *)_cflags_reserve_list(flags, list->values, &list->allocated, count * sizeof(int));
+            if (!values) {
+                return "out of memory";
+            }
+            list->values = values;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            const char * next = (const char *)memchr(pch, delimiter, (size_t)(end - pch));
+            if (!next) {
+                next = end;
+            }
+            const char * error = _cflags_parse_int(pch, (size_t)(next - pch), &list->values[i]);
+            if (error) {
+                return error;
+            }
+            pch = next + 1;
+        }
+        list->count = count;
+        break;
+    }
+    case CFLAGS_TYPE_FLOAT_LIST: {
+        cflags_float_list_t * list = flag->float_list_ptr;
+        list->count = 0;
+
+        if (count > 0) {
+            float * values = (float *)_cflags_reserve_list(flags, list->values, &list->allocated, count * sizeof(float));
+            if (!values) {
+                return "out of memory";
+            }
+            list->values = values;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            const char * next = (const char *)memchr(pch, delimiter, (size_t)(end - pch));
+            if (!next) {
+                next = end;
+            }
+            const char * error = _cflags_parse_float(pch, (size_t)(next - pch), &list->values[i]);
+            if (error) {
+                return error;
+            }
+            pch = next + 1;
+        }
+        list->count = count;
+        break;
+    }
+    default: ;
+    }
+
+    return NULL;
+}
+
+// Returns NULL on success, or a short description of why the value was rejected
+static const char * _cflags_process_flag(cflags_t * flags, cflags_flag_t * flag, const char * value)
+{
+    int int_value = 0;
+    float float_value = 0.0f;
+    const char * error = NULL;
+
+    switch (flag->type) {
+    case CFLAGS_TYPE_INT:
+    case CFLAGS_TYPE_INT_CALLBACK:
+        if (value) {
+            error = _cflags_parse_int(value, strlen(value), &int_value);
+        }
+        break;
+    case CFLAGS_TYPE_FLOAT:
+    case CFLAGS_TYPE_FLOAT_CALLBACK:
+        if (value) {
+            error = _cflags_parse_float(value, strlen(value), &float_value);
+        }
+        break;
+    case CFLAGS_TYPE_STRING_LIST:
+    case CFLAGS_TYPE_INT_LIST:
+    case CFLAGS_TYPE_FLOAT_LIST:
+        // The pointers all share the union, so any of them can be checked
+        if (value && flag->int_list_ptr) {
+            error = _cflags_process_list(flags, flag, value);
+        }
+        break;
+    default: ;
+    }
+
+    if (error) {
+        return error;
+    }
+
+    ++flag->count;
+
+    switch (flag->type) {
+    case CFLAGS_TYPE_STRING:
+        if (flag->string_ptr) {
+            *flag->string_ptr = value;
+        }
+        break;
+    case CFLAGS_TYPE_STRING_CALLBACK:
+        if (flag->string_callback) {
+            flag->string_callback(value);
+        }
+        break;
+    case CFLAGS_TYPE_BOOL:
+        if (flag->bool_ptr) {
+            if (value) {
+                *flag->bool_ptr = _cflags_parse_bool(value);
+            }
+            else {
+                *flag->bool_ptr = true;
+            }
+        }
+        break;
+    case CFLAGS_TYPE_BOOL_CALLBACK:
+        if (flag->bool_callback) {
+            if (value) {
+                flag->bool_callback(_cflags_parse_bool(value));
+            }
+            else {
+                flag->bool_callback(true);
+            }
+        }
+        break;
+    case CFLAGS_TYPE_INT:
+        if (flag->int_ptr) {
+            if (value) {
+                *flag->int_ptr = int_value;
+            }
+        }
+        break;
+    case CFLAGS_TYPE_INT_CALLBACK:
+        if (flag->int_callback) {
+            if (value) {
+                flag->int_callback(int_value);
+            }
+        }
+        break;
+    case CFLAGS_TYPE_FLOAT:
+        if (flag->float_ptr) {
+            if (value) {
+                *flag->float_ptr = float_value;
+            }
+        }
+        break;
+    case CFLAGS_TYPE_FLOAT_CALLBACK:
+        if (flag->float_callback) {
+            if (value) {
+                flag->float_callback(float_value);
+            }
+        }
+        break;
+    default: ;
+    }
+
+    return NULL;
+}
+
+static void _cflags_release_argv(cflags_t * flags)
+{
+    if (flags->argv_owned) {
+        CFLAGS_FREE(flags->argv);
+    }
+    flags->argv = NULL;
+    flags->argv_owned = false;
+}
+
+// Every flag is processed through here, so that callbacks can be counted and timed
+// Returns NULL on success, or a short description of why the value was rejected
+static const char * _cflags_process(cflags_t * flags, cflags_flag_t * flag, const char * value)
+{
+#if defined(CFLAGS_STATS)
+    if (flag->type >= CFLAGS_TYPE_STRING_CALLBACK) {
+        unsigned long long start = _cflags_now_ns();
+        const char * error = _cflags_process_flag(flags, flag, value);
+        unsigned long long elapsed = _cflags_now_ns() - start;
+
+        ++flags->stats.callbacks;
+        flags->stats.callback_ns += elapsed;
+        flag->stats.callback_ns += elapsed;
+        return error;
+    }
+#endif
+
+    return _cflags_process_flag(flags, flag, value);
+}
+
+// Process every environment variable bound to a flag, in a single pass over the environment
+static bool _cflags_apply_env(cflags_t * flags)
+{
+    if (!flags->env_index) {
+        return true;
+    }
+
+    for (char ** env = CFLAGS_ENVIRON; env && *env; ++env) {
+        const char * entry = *env;
+        const char * divider = strchr(entry, '=');
+        if (!divider) {
+            continue;
+        }
+
+        size_t len = (size_t)(divider - entry);
+        uint32_t hash = _cflags_hash(entry, len);
+
+        // Several flags may be bound to the same variable, so every match is processed
+        size_t index = hash & flags->long_index_mask;
+        while (flags->env_index[index]) {
+            cflags_flag_t * flag = flags->env_index[index];
+            if (flag->env_name_hash == hash && _cflags_env_name_equals(flags, flag, entry, len)) {
+                const char * error = _cflags_process(flags, flag, divider + 1);
+                if (error) {
+                    fprintf(stderr, "%s: invalid value '%s' for environment variable '%.*s': %s\n",
+                        flags->program, divider + 1, (int)len, entry, error);
+                    return false;
+                }
+            }
+            index = (index + 1) & flags->long_index_mask;
+        }
+    }
+
+    return true;
+}
+
+// Positional arguments are stored in `buffer`, which must hold at least `buffer_size` pointers
+static bool _cflags_parse_args(cflags_t * flags, int argc, const char * const * argv, const char ** buffer, int buffer_size)
+{
+    flags->argc = 1;
+    flags->argv = buffer;
+    flags->argv[0] = argv[0];
+    flags->program = flags->argv[0];
+
+    // Environment variables are applied first, so arguments take precedence
+    if (!_cflags_apply_env(flags)) {
+        return false;
+    }
+
+    bool passthrough = false;
+    for (int i = 1; i < argc; ++i) {
+        const char * pch = argv[i];
+        if (!passthrough && *pch == '-') {
+            ++pch;
+            if (*pch == '-') {
+                ++pch;
+
+                if (*pch == '\0') {
+                    // All following flags are not to be processed
+                    passthrough = true;
+                    continue;
+                }
+                
+                // Long
+                // The key is not terminated in argv, so it is only ever used with its length
+                // The value is the rest of the argument, so it is already terminated
+                const char * key = pch;
+                const char * value = NULL;
+
+                size_t key_len;
+                const char * divider = strchr(pch, '=');
+                if (divider) {
+                    value = divider + 1;
+                    key_len = (size_t)(divider - key);
+                }
+                else {
+                    key_len = strlen(key);
+                }
+
+                bool next_arg_is_value = (i + 1 < argc && argv[i + 1][0] != '-');
+
+                cflags_flag_t * flag = _cflags_find_long(flags, key, key_len);
+                if (!flag && flags->prefix_matching && flags->prefix_index) {
+                    cflags_flag_t ** ambiguous = NULL;
+                    flag = _cflags_find_prefix(flags, key, key_len, &ambiguous);
+                    if (ambiguous) {
+                        _cflags_print_ambiguous(flags, key, key_len, ambiguous);
+                        return false;
+                    }
+                }
+
+                if (!flag) {
+                    fprintf(stderr, "%s: unrecognized option '--%.*s'", flags->program, (int)key_len, key);
+                    _cflags_print_suggestions(flags, "--", key, key_len);
+                    return false;
+                }
+
+                if (!value && next_arg_is_value) {
+                    value = argv[i + 1];
+                    ++i;
+                }
+
+                if (value) {
+                    const char * error = _cflags_process(flags, flag, value);
+                    if (error) {
+                        fprintf(stderr, "%s: invalid value '%s' for option '--%.*s': %s\n", flags->program, value, (int)key_len, key, error);
+                        return false;
+                    }
+                }
+                else if (flag->type == CFLAGS_TYPE_BOOL || flag->type == CFLAGS_TYPE_BOOL_CALLBACK) {
+                    _cflags_process(flags, flag, NULL);
+                }
+                else {
+                    fprintf(stderr, "%s: option '--%.*s' requires an value\n", flags->program, (int)key_len, key);
+                    return false;
+                }
+            }
+            else {
                 // Short
                 while (*pch) {
                     bool is_last_short_flag = (*(pch + 1) == '\0');
                     bool next_arg_is_value = (i + 1 < argc && argv[i + 1][0] != '-');
                     
-                    bool found = false;
-                    cflags_flag_t * flag = flags->first_flag;
-                    while (flag) {
-                        if (flag->short_name == *pch) {
-                            found = true;
-
-                            if (is_last_short_flag && next_arg_is_value) {
-                                _cflags_process_flag(flag, argv[i + 1]);
-                                ++i;
-                            }
-                            else if (flag->type == CFLAGS_TYPE_BOOL || flag->type == CFLAGS_TYPE_BOOL_CALLBACK) {
-                                _cflags_process_flag(flag, NULL);
-                            }
-                            else {
-                                fprintf(stderr, "%s: option '-%c' requires an value\n", flags->program, *pch);
-                                return false;
-                            }
-
-                            break;
+                    cflags_flag_t * flag = _cflags_find_short(flags, *pch);
+                    if (!flag) {
+                        fprintf(stderr, "%s: unrecognized option '-%c'\n", flags->program, *pch);
+                        return false;
+                    }
+
+                    if (is_last_short_flag && next_arg_is_value) {
+                        const char * error = _cflags_process(flags, flag, argv[i + 1]);
+                        if (error) {
+                            fprintf(stderr, "%s: invalid value '%s' for option '-%c': %s\n", flags->program, argv[i + 1], *pch, error);
+                            return false;
                         }
+                        ++i;
+                    }
+                    else if (flag->type == CFLAGS_TYPE_BOOL || flag->type == CFLAGS_TYPE_BOOL_CALLBACK) {
+                        _cflags_process(flags, flag, NULL);
+                    }
+                    else {
+                        fprintf(stderr, "%s: option '-%c' requires an value\n", flags->program, *pch);
+                        return false;
+                    }
+
+                    ++pch;
+                }
+            }
+        }
+        else {
+            if (flags->argc == buffer_size) {
+                fprintf(stderr, "%s: too many positional arguments, at most %d are allowed\n", flags->program, buffer_size - 1);
+                return false;
+            }
+            flags->argv[flags->argc] = pch;
+            ++flags->argc;
+        }
+    }
+
+    return true;
+}
+
+#if defined(CFLAGS_HAVE_MMAP)
+static void _cflags_file_id_from_stat(cflags_file_id_t * id, const struct stat * st)
+{
+    id->device = (unsigned long long)st->st_dev;
+    id->inode = (unsigned long long)st->st_ino;
+    id->size = (unsigned long long)st->st_size;
+#if defined(__APPLE__)
+    id->modified_ns = (unsigned long long)st->st_mtimespec.tv_sec * 1000000000ull + (unsigned long long)st->st_mtimespec.tv_nsec;
+#elif defined(st_mtime)
+    // st_mtime is a macro for st_mtim.tv_sec wherever the nanosecond field is exposed
+    id->modified_ns = (unsigned long long)st->st_mtim.tv_sec * 1000000000ull + (unsigned long long)st->st_mtim.tv_nsec;
+#else
+    id->modified_ns = (unsigned long long)st->st_mtime * 1000000000ull;
+#endif
+}
+#endif
+
+static bool _cflags_same_file(const cflags_file_id_t * a, const cflags_file_id_t * b)
+{
+    return (a->device != 0 || a->inode != 0) && a->device == b->device && a->inode == b->inode;
+}
+
+static bool _cflags_file_unchanged(const cflags_file_id_t * a, const cflags_file_id_t * b)
+{
+    return _cflags_same_file(a, b) && a->size == b->size && a->modified_ns == b->modified_ns;
+}
+
+static bool _cflags_add_mapping_entry(cflags_t * flags, cflags_mapping_t * mapping, cflags_flag_t * flag, const char * value)
+{
+    if (mapping->entry_count == mapping->entry_capacity) {
+        size_t capacity = (mapping->entry_capacity ? mapping->entry_capacity * 2 : 16);
+        cflags_mapping_entry_t * entries = (cflags_mapping_entry_t *)CFLAGS_REALLOC(mapping->entries, capacity * sizeof(cflags_mapping_entry_t));
+        if (!entries) {
+            fprintf(stderr, CFLAGS_ERROR_OOM);
+            return false;
+        }
+        mapping->entries = entries;
+        mapping->entry_capacity = capacity;
+        CFLAGS_STAT(++flags->stats.allocations);
+    }
+#if !defined(CFLAGS_STATS)
+    (void)flags;
+#endif
+
+    mapping->entries[mapping->entry_count].flag = flag;
+    mapping->entries[mapping->entry_count].value = value;
+    ++mapping->entry_count;
+    return true;
+}
+
+// Load a file so that its contents can be tokenized in place
+// The returned data has one writable byte past the end of the file, to terminate the last token
+static cflags_mapping_t * _cflags_map_file(cflags_t * flags, const char * path, bool config)
+{
+#if defined(CFLAGS_HAVE_MMAP)
+    struct stat current;
+    if (stat(path, &current) == 0) {
+        cflags_file_id_t id;
+        _cflags_file_id_from_stat(&id, &current);
+        for (cflags_mapping_t * loaded = flags->mappings; loaded; loaded = loaded->next) {
+            if (loaded->config == config && loaded->complete && _cflags_file_unchanged(&loaded->id, &id)) {
+                return loaded;
+            }
+        }
+    }
+#endif
+
+    cflags_mapping_t * mapping = (cflags_mapping_t *)CFLAGS_CALLOC(1, sizeof(cflags_mapping_t));
+    if (!mapping) {
+        fprintf(stderr, CFLAGS_ERROR_OOM);
+        return NULL;
+    }
+
+    mapping->config = config;
+
+#if defined(CFLAGS_HAVE_MMAP)
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        CFLAGS_FREE(mapping);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        CFLAGS_FREE(mapping);
+        return NULL;
+    }
+
+    _cflags_file_id_from_stat(&mapping->id, &st);
+    mapping->size = (size_t)st.st_size;
+
+    // The remainder of the last page is zero filled and, being a private mapping, writable
+    // If the file ends exactly on a page boundary there is no spare byte, so read it instead
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (mapping->size > 0 && page_size > 0 && mapping->size % (size_t)page_size != 0) {
+        void * data = mmap(NULL, mapping->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            mapping->data = (char *)data;
+            mapping->mapped = true;
+        }
+    }
+
+    if (!mapping->mapped) {
+        mapping->data = (char *)CFLAGS_MALLOC(mapping->size + 1);
+        size_t offset = 0;
+        while (mapping->data && offset < mapping->size) {
+            ssize_t result = read(fd, mapping->data + offset, mapping->size - offset);
+            if (result <= 0) {
+                break;
+            }
+            offset += (size_t)result;
+        }
+        mapping->size = offset;
+    }
+
+    close(fd);
+
+#else
+
+    FILE * file = fopen(path, "rb");
+    if (!file) {
+        CFLAGS_FREE(mapping);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    mapping->data = (char *)CFLAGS_MALLOC((size > 0 ? (size_t)size : 0) + 1);
+    if (mapping->data && size > 0) {
+        mapping->size = fread(mapping->data, 1, (size_t)size, file);
+    }
+
+    fclose(file);
+
+#endif
+
+    if (!mapping->data) {
+        fprintf(stderr, CFLAGS_ERROR_OOM);
+        CFLAGS_FREE(mapping);
+        return NULL;
+    }
+
+    CFLAGS_STAT(flags->stats.allocations += (mapping->mapped ? 1 : 2));
+
+    mapping->next = flags->mappings;
+    flags->mappings = mapping;
+    return mapping;
+}
+
+static void _cflags_unmap_files(cflags_t * flags)
+{
+    cflags_mapping_t * mapping = flags->mappings;
+    while (mapping) {
+        cflags_mapping_t * tmp = mapping;
+        mapping = mapping->next;
+
+#if defined(CFLAGS_HAVE_MMAP)
+        if (tmp->mapped) {
+            munmap(tmp->data, tmp->size);
+        }
+        else {
+            CFLAGS_FREE(tmp->data);
+        }
+#else
+        CFLAGS_FREE(tmp->data);
+#endif
+
+        CFLAGS_FREE(tmp->entries);
+        CFLAGS_FREE(tmp);
+    }
+
+    flags->mappings = NULL;
+}
+
+// Find the next whitespace separated token in [*cursor, end), and NUL terminate it in place
+// Quotes are removed, and backslash escapes are handled outside of quotes and inside double quotes
+// Returns NULL when there are no more tokens
+static char * _cflags_next_token(char ** cursor, char * end)
+{
+    char * read = *cursor;
+    while (read < end && isspace((unsigned char)*read)) {
+        ++read;
+    }
+
+    if (read == end) {
+        *cursor = end;
+        return NULL;
+    }
+
+    // The unquoted token is never longer than the quoted one, so it can be written over itself
+    char * token = read;
+    char * write = read;
+    char quote = '\0';
+    while (read < end) {
+        char c = *read;
+        if (quote) {
+            if (c == quote) {
+                quote = '\0';
+                ++read;
+                continue;
+            }
+            if (c == '\\' && quote == '"' && read + 1 < end) {
+                c = *++read;
+            }
+        }
+        else {
+            if (isspace((unsigned char)c)) {
+                break;
+            }
+            if (c == '\'' || c == '"') {
+                quote = c;
+                ++read;
+                continue;
+            }
+            if (c == '\\' && read + 1 < end) {
+                c = *++read;
+            }
+        }
+
+        *write++ = c;
+        ++read;
+    }
+
+    *cursor = (read < end ? read + 1 : end);
+    *write = '\0';
+    return token;
+}
+
+struct _cflags_arg_list
+{
+    const char ** data;
+    int     size;
+    int     capacity;
+};
+
+static bool _cflags_arg_list_push(cflags_t * flags, struct _cflags_arg_list * list, const char * arg)
+{
+    if (list->size == list->capacity) {
+        int capacity = (list->capacity ? list->capacity * 2 : 64);
+        const char ** tmp = (const char **)CFLAGS_REALLOC(list->data, capacity * sizeof(const char *));
+        if (!tmp) {
+            fprintf(stderr, CFLAGS_ERROR_OOM);
+            return false;
+        }
+        list->data = tmp;
+        list->capacity = capacity;
+        CFLAGS_STAT(++flags->stats.allocations);
+    }
+#if !defined(CFLAGS_STATS)
+    (void)flags;
+#endif
+
+    list->data[list->size] = arg;
+    ++list->size;
+    return true;
+}
 
-                        flag = flag->next;
-                    }
+// Append `arg` to `list`, recursively replacing @file arguments with the tokens in the file
+// `stack` holds the files currently being expanded, to detect cycles
+static bool _cflags_expand_arg(cflags_t * flags, struct _cflags_arg_list * list, const char * arg, const cflags_file_id_t ** stack, int depth, bool * passthrough)
+{
+    if (*passthrough || arg[0] != '@' || arg[1] == '\0') {
+        if (strcmp(arg, "--") == 0) {
+            *passthrough = true;
+        }
+        return _cflags_arg_list_push(flags, list, arg);
+    }
 
-                    if (!found) {
-                        fprintf(stderr, "%s: unrecognized option '-%c'\n", flags->program, *pch);
-                        return false;
-                    }
-                    
-                    ++pch;
-                }
+    const char * path = arg + 1;
+
+    if (depth == CFLAGS_RESPONSE_FILE_MAX_DEPTH) {
+        fprintf(stderr, "%s: response file '%s' is nested too deeply\n", flags->program, path);
+        return false;
+    }
+
+    cflags_mapping_t * mapping = _cflags_map_file(flags, path, false);
+    if (!mapping) {
+        fprintf(stderr, "%s: unable to read response file '%s'\n", flags->program, path);
+        return false;
+    }
+
+    for (int i = 0; i < depth; ++i) {
+        if (_cflags_same_file(stack[i], &mapping->id)) {
+            fprintf(stderr, "%s: response file '%s' includes itself\n", flags->program, path);
+            return false;
+        }
+    }
+
+    if (!mapping->complete) {
+        char * cursor = mapping->data;
+        char * end = mapping->data + mapping->size;
+        char * token;
+        while ((token = _cflags_next_token(&cursor, end))) {
+            if (!_cflags_add_mapping_entry(flags, mapping, NULL, token)) {
+                return false;
             }
         }
-        else {
-            ++flags->argc;
-            char ** tmp = (char **)realloc(flags->argv, flags->argc * sizeof(char *));
-            if (!tmp) {
-                fprintf(stderr, CFLAGS_ERROR_OOM);
+        mapping->complete = true;
+    }
+
+    stack[depth] = &mapping->id;
+
+    for (size_t i = 0; i < mapping->entry_count; ++i) {
+        if (!_cflags_expand_arg(flags, list, mapping->entries[i].value, stack, depth + 1, passthrough)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// If enabled, replace argc/argv with a copy where every @file has been expanded
+// The tokens are not copied, they point into the loaded files
+static bool _cflags_expand_response_files(cflags_t * flags, int * argc, const char * const ** argv)
+{
+    if (!flags->expand_response_files) {
+        return true;
+    }
+
+    bool found = false;
+    for (int i = 1; i < *argc; ++i) {
+        if (strcmp((*argv)[i], "--") == 0) {
+            break;
+        }
+        if ((*argv)[i][0] == '@') {
+            found = true;
+            break;
+        }
+    }
+
+    if (!found) {
+        return true;
+    }
+
+    CFLAGS_FREE(flags->response_argv);
+    flags->response_argv = NULL;
+    flags->program = (*argv)[0];
+
+    struct _cflags_arg_list list = { NULL, 0, 0 };
+    const cflags_file_id_t * stack[CFLAGS_RESPONSE_FILE_MAX_DEPTH];
+    bool passthrough = false;
+
+    for (int i = 0; i < *argc; ++i) {
+        bool ok = (i == 0
+            ? _cflags_arg_list_push(flags, &list, (*argv)[i])
+            : _cflags_expand_arg(flags, &list, (*argv)[i], stack, 0, &passthrough));
+
+        if (!ok) {
+            CFLAGS_FREE(list.data);
+            return false;
+        }
+    }
+
+    flags->response_argv = list.data;
+    *argc = list.size;
+    *argv = list.data;
+    return true;
+}
+
+// Parse into `buffer`, or an array allocated to hold every argument if it is NULL
+static bool _cflags_parse(cflags_t * flags, int argc, const char * const * argv, const char ** buffer, int buffer_size)
+{
+    _cflags_release_argv(flags);
+
+    if (!flags->frozen && !cflags_freeze(flags)) {
+        return false;
+    }
+
+    // The word being completed is answered as typed, so a partial @file is never expanded
+    flags->completed = false;
+    if (flags->completion && argc > 1) {
+        flags->argc = 0;
+        flags->program = argv[0];
+        if (_cflags_handle_completion(flags, argc, argv)) {
+            return false;
+        }
+    }
+
+    if (!_cflags_expand_response_files(flags, &argc, &argv)) {
+        return false;
+    }
+
+    if (!buffer) {
+        // There can never be more positional arguments than arguments, so this is the only allocation
+        buffer_size = (argc > 1 ? argc : 1);
+        buffer = (const char **)CFLAGS_MALLOC(buffer_size * sizeof(const char *));
+        if (!buffer) {
+            fprintf(stderr, CFLAGS_ERROR_OOM);
+            return false;
+        }
+        CFLAGS_STAT(++flags->stats.allocations);
+
+        flags->argv = buffer;
+        flags->argv_owned = true;
+    }
+
+    return _cflags_parse_args(flags, argc, argv, buffer, buffer_size);
+}
+
+static bool _cflags_parse_timed(cflags_t * flags, int argc, const char * const * argv, const char ** buffer, int buffer_size)
+{
+#if defined(CFLAGS_STATS)
+    unsigned long long start = _cflags_now_ns();
+    unsigned long long callback_start = flags->stats.callback_ns;
+
+    bool result = _cflags_parse(flags, argc, argv, buffer, buffer_size);
+
+    unsigned long long elapsed = _cflags_now_ns() - start;
+    flags->stats.library_ns += elapsed - (flags->stats.callback_ns - callback_start);
+    return result;
+#else
+    return _cflags_parse(flags, argc, argv, buffer, buffer_size);
+#endif
+}
+
+// argv is never written to, so the same arguments can be parsed again or shared between threads
+// It is taken as `char **` to match main(), since C will not convert that to `const char * const *`
+// With completion set, a completion request is answered on stdout instead, and this returns false with completed set
+static bool cflags_parse(cflags_t * flags, int argc, char ** argv)
+{
+    return _cflags_parse_timed(flags, argc, (const char * const *)argv, NULL, 0);
+}
+
+// Parse without allocating, storing the program name and positional arguments in `buffer`
+// The flags must already be frozen with cflags_freeze(), otherwise the first parse will allocate
+// Expanding response files also allocates, if it is enabled and an @file argument is present
+// Fails if `buffer` cannot hold the program name plus every positional argument
+static bool cflags_parse_buffer(cflags_t * flags, int argc, char ** argv, const char ** buffer, int buffer_size)
+{
+    if (buffer_size < 1) {
+        fprintf(stderr, "%s: positional argument buffer is too small\n", argv[0]);
+        return false;
+    }
+
+    return _cflags_parse_timed(flags, argc, (const char * const *)argv, buffer, buffer_size);
+}
+
+#define CFLAGS_CONFIG_MAX_KEY 256
+
+static void _cflags_trim(char ** begin, char ** end)
+{
+    while (*begin < *end && isspace((unsigned char)**begin)) {
+        ++*begin;
+    }
+    while (*end > *begin && isspace((unsigned char)*(*end - 1))) {
+        --*end;
+    }
+}
+
+// Load flag values from a file of `key = value` lines, as if they had been passed as `--key=value`
+// Lines may also be written as `--key=value`, `key value`, or just `key` for bool flags
+// Blank lines and lines starting with '#' or ';' are ignored, and values may be wrapped in quotes
+// Keys following a `[section]` line are looked up as `section.key`
+// Call this before cflags_parse(), so that environment variables and arguments take precedence
+static bool cflags_load_config(cflags_t * flags, const char * path)
+{
+    if (!flags->frozen && !cflags_freeze(flags)) {
+        return false;
+    }
+
+    cflags_mapping_t * mapping = _cflags_map_file(flags, path, true);
+    if (!mapping) {
+        fprintf(stderr, "cflags: unable to read config file '%s'\n", path);
+        return false;
+    }
+
+    if (mapping->complete) {
+        // The file is unchanged since it was loaded, and its values were all accepted then
+        for (size_t i = 0; i < mapping->entry_count; ++i) {
+            _cflags_process(flags, mapping->entries[i].flag, mapping->entries[i].value);
+        }
+        return true;
+    }
+
+    char key_buffer[CFLAGS_CONFIG_MAX_KEY];
+    size_t section_len = 0;
+
+    char * cursor = mapping->data;
+    char * data_end = mapping->data + mapping->size;
+    size_t line_number = 0;
+    while (cursor < data_end) {
+        ++line_number;
+
+        char * line = cursor;
+        char * line_end = (char *)memchr(cursor, '\n', (size_t)(data_end - cursor));
+        if (!line_end) {
+            line_end = data_end;
+        }
+        cursor = (line_end < data_end ? line_end + 1 : data_end);
+
+        _cflags_trim(&line, &line_end);
+        if (line == line_end || *line == '#' || *line == ';') {
+            continue;
+        }
+
+        if (*line == '[') {
+            char * section = line + 1;
+            char * section_end = (char *)memchr(section, ']', (size_t)(line_end - section));
+            if (!section_end) {
+                fprintf(stderr, "%s:%zu: expected ']'\n", path, line_number);
+                return false;
+            }
+            _cflags_trim(&section, &section_end);
+
+            section_len = (size_t)(section_end - section);
+            if (section_len + 1 >= CFLAGS_CONFIG_MAX_KEY) {
+                fprintf(stderr, "%s:%zu: section name is too long\n", path, line_number);
+                return false;
+            }
+            memcpy(key_buffer, section, section_len);
+            CFLAGS_STAT(flags->stats.bytes_copied += section_len);
+            if (section_len > 0) {
+                key_buffer[section_len++] = '.';
+            }
+            continue;
+        }
+
+        if (line_end - line > 2 && line[0] == '-' && line[1] == '-') {
+            line += 2;
+        }
+
+        char * key = line;
+        char * key_end = key;
+        while (key_end < line_end && *key_end != '=' && !isspace((unsigned char)*key_end)) {
+            ++key_end;
+        }
+
+        char * value = key_end;
+        char * value_end = line_end;
+        _cflags_trim(&value, &value_end);
+        if (value < value_end && *value == '=') {
+            ++value;
+            _cflags_trim(&value, &value_end);
+        }
+
+        if (value_end - value >= 2 && (*value == '"' || *value == '\'') && *(value_end - 1) == *value) {
+            ++value;
+            --value_end;
+        }
+
+        size_t key_len = (size_t)(key_end - key);
+        const char * lookup = key;
+        if (section_len > 0) {
+            if (section_len + key_len > CFLAGS_CONFIG_MAX_KEY) {
+                fprintf(stderr, "%s:%zu: option name is too long\n", path, line_number);
                 return false;
             }
-            flags->argv = tmp;
-            flags->argv[flags->argc - 1] = pch;
+            memcpy(key_buffer + section_len, key, key_len);
+            CFLAGS_STAT(flags->stats.bytes_copied += key_len);
+            lookup = key_buffer;
+            key_len += section_len;
+        }
+
+        cflags_flag_t * flag = _cflags_find_long(flags, lookup, key_len);
+        if (!flag) {
+            fprintf(stderr, "%s:%zu: unrecognized option '%.*s'", path, line_number, (int)key_len, lookup);
+            _cflags_print_suggestions(flags, "", lookup, key_len);
+            return false;
+        }
+
+        // Terminate the value in place, over the newline or the spare byte past the end of the data
+        bool has_value = (value < value_end || (key_end < line_end && *key_end == '='));
+        *value_end = '\0';
+
+        if (has_value) {
+            const char * error = _cflags_process(flags, flag, value);
+            if (error) {
+                fprintf(stderr, "%s:%zu: invalid value '%s' for option '%.*s': %s\n", path, line_number, value, (int)key_len, lookup, error);
+                return false;
+            }
+        }
+        else if (flag->type == CFLAGS_TYPE_BOOL || flag->type == CFLAGS_TYPE_BOOL_CALLBACK) {
+            _cflags_process(flags, flag, NULL);
+        }
+        else {
+            fprintf(stderr, "%s:%zu: option '%.*s' requires an value\n", path, line_number, (int)key_len, lookup);
+            return false;
+        }
+
+        if (!_cflags_add_mapping_entry(flags, mapping, flag, (has_value ? value : NULL))) {
+            return false;
         }
     }
 
+    mapping->complete = true;
     return true;
 }
 
+#if defined(CFLAGS_STATS)
+
+static void cflags_reset_stats(cflags_t * flags)
+{
+    memset(&flags->stats, 0, sizeof(flags->stats));
+
+    cflags_flag_t * flag = flags->first_flag;
+    while (flag) {
+        memset(&flag->stats, 0, sizeof(flag->stats));
+        flag = flag->next;
+    }
+}
+
+#endif // CFLAGS_STATS
+
 static void cflags_free(cflags_t * flags)
 {
-    free(flags->argv);
-    flags->argv = NULL;
+    _cflags_release_argv(flags);
+
+    CFLAGS_FREE(flags->response_argv);
+    flags->response_argv = NULL;
+
+    _cflags_unmap_files(flags);
+
+    CFLAGS_FREE(flags->long_index);
+    flags->long_index = NULL;
+
+    CFLAGS_FREE(flags->env_index);
+    flags->env_index = NULL;
+
+    CFLAGS_FREE(flags->prefix_index);
+    flags->prefix_index = NULL;
+
+    CFLAGS_FREE(flags->suggestions);
+    flags->suggestions = NULL;
+
+    CFLAGS_FREE(flags->usage_table.data);
+    CFLAGS_FREE(flags->usage_text.data);
+    CFLAGS_FREE(flags->schema_text.data);
 
-    cflags_flag_t * tmp = NULL;
     cflags_flag_t * flag = flags->first_flag;
     while (flag) {
-        tmp = flag;
+        if (flag->type == CFLAGS_TYPE_STRING_LIST && flag->string_list_ptr) {
+            CFLAGS_FREE(flag->string_list_ptr->values);
+            memset(flag->string_list_ptr, 0, sizeof(cflags_string_list_t));
+        }
+        else if (flag->type == CFLAGS_TYPE_INT_LIST && flag->int_list_ptr) {
+            CFLAGS_FREE(flag->int_list_ptr->values);
+            memset(flag->int_list_ptr, 0, sizeof(cflags_int_list_t));
+        }
+        else if (flag->type == CFLAGS_TYPE_FLOAT_LIST && flag->float_list_ptr) {
+            CFLAGS_FREE(flag->float_list_ptr->values);
+            memset(flag->float_list_ptr, 0, sizeof(cflags_float_list_t));
+        }
         flag = flag->next;
-        free(tmp);
     }
 
-    free(flags);
+    cflags_flag_block_t * tmp = NULL;
+    cflags_flag_block_t * block = flags->first_block;
+    while (block) {
+        tmp = block;
+        block = block->next;
+        CFLAGS_FREE(tmp);
+    }
+
+    CFLAGS_FREE(flags);
     flags = NULL;
 }
 
+// The terminal width of stdout, or $COLUMNS, or 80 when output is not to a terminal
+static size_t _cflags_terminal_width(void)
+{
+#if !defined(_WIN32)
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+        return size.ws_col;
+    }
+#endif
+
+    const char * columns = getenv("COLUMNS");
+    int width = 0;
+    if (columns && !_cflags_parse_int(columns, strlen(columns), &width) && width > 0) {
+        return (size_t)width;
+    }
+    return 80;
+}
+
+#define CFLAGS_USAGE_NAME_WIDTH         20
+#define CFLAGS_USAGE_DESCRIPTION_COLUMN (2 + 4 + 2 + CFLAGS_USAGE_NAME_WIDTH)
+
+// Descriptions are wrapped at spaces to fit `width`, unless that would leave them fewer than 20 columns
+static bool _cflags_render_usage_table(cflags_t * flags, size_t width)
+{
+    cflags_buffer_t * table = &flags->usage_table;
+    table->size = 0;
+
+    size_t wrap = (width >= CFLAGS_USAGE_DESCRIPTION_COLUMN + 20 ? width - CFLAGS_USAGE_DESCRIPTION_COLUMN : SIZE_MAX);
+
+    for (cflags_flag_t * flag = flags->first_flag; flag; flag = flag->next) {
+        char prefix[4] = { '-', flag->short_name, ',', ' ' };
+        if (!_cflags_buffer_fill(table, ' ', 2) ||
+            !(flag->short_name != '\0' ? _cflags_buffer_append(table, prefix, 4) : _cflags_buffer_fill(table, ' ', 4))) {
+            return false;
+        }
+
+        size_t long_name_len = (flag->long_name ? strlen(flag->long_name) : 0);
+        if (flag->long_name && (!_cflags_buffer_append(table, "--", 2) || !_cflags_buffer_append(table, flag->long_name, long_name_len))) {
+            return false;
+        }
+
+        // Flags with only a short name have no "--" either, so they are padded by two more
+        bool padded = (long_name_len > CFLAGS_USAGE_NAME_WIDTH
+            ? _cflags_buffer_append(table, "\n", 1) && _cflags_buffer_fill(table, ' ', CFLAGS_USAGE_DESCRIPTION_COLUMN)
+            : _cflags_buffer_fill(table, ' ', CFLAGS_USAGE_NAME_WIDTH - long_name_len + (flag->long_name ? 0 : 2)));
+        if (!padded) {
+            return false;
+        }
+
+        const char * description = (flag->description ? flag->description : "");
+        size_t remaining = strlen(description);
+        while (remaining > wrap) {
+            // Break at the last space that fits, or the first one after it for a word that is too long
+            size_t line_len = wrap;
+            while (line_len > 0 && description[line_len] != ' ') {
+                --line_len;
+            }
+            if (line_len == 0) {
+                const char * space = (const char *)memchr(description + wrap, ' ', remaining - wrap);
+                if (!space) {
+                    break;
+                }
+                line_len = (size_t)(space - description);
+            }
+
+            if (!_cflags_buffer_append(table, description, line_len) ||
+                !_cflags_buffer_append(table, "\n", 1) ||
+                !_cflags_buffer_fill(table, ' ', CFLAGS_USAGE_DESCRIPTION_COLUMN)) {
+                return false;
+            }
+
+            while (line_len < remaining && description[line_len] == ' ') {
+                ++line_len;
+            }
+            description += line_len;
+            remaining -= line_len;
+        }
+
+        if (!_cflags_buffer_append(table, description, remaining) || !_cflags_buffer_append(table, "\n", 1)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Render the usage text, wrapped to `width` columns, or to the terminal when `width` is 0
+// The flag table is only rendered again after flags are added or the width changes
+// Returns NUL terminated text owned by `flags`, valid until the next call or cflags_free(), or NULL when out of memory
+static const char * cflags_format_usage(cflags_t * flags, const char * usage, const char * above, const char * below, size_t width)
+{
+    if (!flags->frozen && !cflags_freeze(flags)) {
+        return NULL;
+    }
+
+    if (width == 0) {
+        width = _cflags_terminal_width();
+    }
+
+    if (!flags->usage_valid || flags->usage_width != width) {
+        if (!_cflags_render_usage_table(flags, width)) {
+            return NULL;
+        }
+        flags->usage_valid = true;
+        flags->usage_width = width;
+    }
+
+    cflags_buffer_t * text = &flags->usage_text;
+    text->size = 0;
+    bool rendered =
+        _cflags_buffer_append_string(text, flags->program) &&
+        _cflags_buffer_append(text, " ", 1) &&
+        _cflags_buffer_append_string(text, usage) &&
+        _cflags_buffer_append(text, "\n", 1) &&
+        _cflags_buffer_append_string(text, above) &&
+        _cflags_buffer_append(text, "\n\n", 2) &&
+        _cflags_buffer_append(text, flags->usage_table.data, flags->usage_table.size) &&
+        _cflags_buffer_append(text, "\n", 1) &&
+        _cflags_buffer_append_string(text, below) &&
+        _cflags_buffer_append(text, "\n", 2);
+    if (!rendered) {
+        return NULL;
+    }
+
+    // The terminator is copied with the final newline, but is not part of the text
+    --text->size;
+    return text->data;
+}
+
 static void cflags_print_usage(cflags_t * flags, const char * usage, const char * above, const char * below)
 {
-    printf("%s %s\n", flags->program, usage);
-    printf("%s\n\n", above);
+    const char * text = cflags_format_usage(flags, usage, above, below, 0);
+    if (text) {
+        _cflags_write_stdout(text, flags->usage_text.size);
+    }
+}
 
-    cflags_flag_t * flag = flags->first_flag;
-    while (flag) {
-        printf("  ");
-        if (flag->short_name != '\0') {
-            printf("-%c, ", flag->short_name);
+// Append str escaped for a JSON string, without the quotes
+static bool _cflags_buffer_append_json_chars(cflags_buffer_t * buffer, const char * str, size_t len)
+{
+    const char * run = str;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)str[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
         }
-        else {
-            printf("    ");
+
+        char escape[7] = { '\\', (char)c, 0, 0, 0, 0, 0 };
+        size_t escape_len = 2;
+        if (c == '\n') {
+            escape[1] = 'n';
         }
-        size_t long_name_len = 0;
-        if (flag->long_name) {
-            printf("--%s", flag->long_name);
-            long_name_len = strlen(flag->long_name);
+        else if (c == '\t') {
+            escape[1] = 't';
         }
-        if (long_name_len > 20) {
-            printf("\n                            ");
+        else if (c < 0x20) {
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            escape_len = 6;
         }
-        else {
-            for (size_t i = 0; i < 20 - long_name_len; ++i) {
-                printf(" ");
-            }
+
+        if (!_cflags_buffer_append(buffer, run, (size_t)(str + i - run)) || !_cflags_buffer_append(buffer, escape, escape_len)) {
+            return false;
         }
-        printf("%s\n", flag->description);
-        flag = flag->next;
+        run = str + i + 1;
+    }
+
+    return _cflags_buffer_append(buffer, run, (size_t)(str + len - run));
+}
+
+static bool _cflags_buffer_append_json(cflags_buffer_t * buffer, const char * str, size_t len)
+{
+    return _cflags_buffer_append(buffer, "\"", 1) && _cflags_buffer_append_json_chars(buffer, str, len) && _cflags_buffer_append(buffer, "\"", 1);
+}
+
+// The environment variable a flag is read from, named by cflags_bind_env() or cflags_set_env_prefix()
+static bool _cflags_buffer_append_env_name(cflags_buffer_t * buffer, cflags_t * flags, cflags_flag_t * flag)
+{
+    if (flag->env_name) {
+        return _cflags_buffer_append_json(buffer, flag->env_name, strlen(flag->env_name));
+    }
+
+    if (!_cflags_buffer_append(buffer, "\"", 1) || !_cflags_buffer_append_json_chars(buffer, flags->env_prefix, strlen(flags->env_prefix))) {
+        return false;
+    }
+    for (const char * pch = flag->long_name; *pch; ++pch) {
+        char c = _cflags_env_char(*pch);
+        if (!_cflags_buffer_append_json_chars(buffer, &c, 1)) {
+            return false;
+        }
+    }
+    return _cflags_buffer_append(buffer, "\"", 1);
+}
+
+static const char * _cflags_type_name(cflags_type_t type)
+{
+    switch (type) {
+    case CFLAGS_TYPE_STRING:
+    case CFLAGS_TYPE_STRING_CALLBACK:
+        return "string";
+    case CFLAGS_TYPE_BOOL:
+    case CFLAGS_TYPE_BOOL_CALLBACK:
+        return "bool";
+    case CFLAGS_TYPE_INT:
+    case CFLAGS_TYPE_INT_CALLBACK:
+        return "int";
+    case CFLAGS_TYPE_FLOAT:
+    case CFLAGS_TYPE_FLOAT_CALLBACK:
+        return "float";
+    case CFLAGS_TYPE_STRING_LIST:
+        return "string_list";
+    case CFLAGS_TYPE_INT_LIST:
+        return "int_list";
+    case CFLAGS_TYPE_FLOAT_LIST:
+        return "float_list";
+    default:
+        return "undefined";
+    }
+}
+
+// Describe every flag as JSON, in the order they were added, e.g.
+// {"flags":[{"long_name":"threads","short_name":"t","type":"int","description":"number of threads"}]}
+// List flags also have a "delimiter", and flags bound with cflags_bind_env() an "env"
+// Returns NUL terminated text owned by `flags`, which is kept until flags are added, or NULL when out of memory
+static const char * cflags_format_schema(cflags_t * flags)
+{
+    if (!flags->frozen && !cflags_freeze(flags)) {
+        return NULL;
+    }
+
+    cflags_buffer_t * text = &flags->schema_text;
+    if (flags->schema_valid) {
+        return text->data;
+    }
+
+    text->size = 0;
+    if (!_cflags_buffer_append_string(text, "{\"flags\":[")) {
+        return NULL;
+    }
+
+    for (cflags_flag_t * flag = flags->first_flag; flag; flag = flag->next) {
+        bool rendered =
+            _cflags_buffer_append_string(text, (flag == flags->first_flag ? "{" : ",{")) &&
+            _cflags_buffer_append_string(text, "\"long_name\":") &&
+            (flag->long_name
+                ? _cflags_buffer_append_json(text, flag->long_name, strlen(flag->long_name))
+                : _cflags_buffer_append_string(text, "null")) &&
+            _cflags_buffer_append_string(text, ",\"short_name\":") &&
+            (flag->short_name != '\0'
+                ? _cflags_buffer_append_json(text, &flag->short_name, 1)
+                : _cflags_buffer_append_string(text, "null")) &&
+            _cflags_buffer_append_string(text, ",\"type\":\"") &&
+            _cflags_buffer_append_string(text, _cflags_type_name(flag->type)) &&
+            _cflags_buffer_append_string(text, "\",\"description\":") &&
+            _cflags_buffer_append_json(text, (flag->description ? flag->description : ""), (flag->description ? strlen(flag->description) : 0));
+
+        if (rendered && flag->type >= CFLAGS_TYPE_STRING_LIST && flag->type <= CFLAGS_TYPE_FLOAT_LIST) {
+            char delimiter = (flag->delimiter != '\0' ? flag->delimiter : ',');
+            rendered = _cflags_buffer_append_string(text, ",\"delimiter\":") && _cflags_buffer_append_json(text, &delimiter, 1);
+        }
+        if (rendered && (flag->env_name || (flags->env_prefix && flag->long_name))) {
+            rendered = _cflags_buffer_append_string(text, ",\"env\":") && _cflags_buffer_append_env_name(text, flags, flag);
+        }
+        if (!rendered || !_cflags_buffer_append(text, "}", 1)) {
+            return NULL;
+        }
+    }
+
+    if (!_cflags_buffer_append(text, "]}", 3)) {
+        return NULL;
     }
+    --text->size;
 
-    printf("\n%s\n", below);
+    flags->schema_valid = true;
+    return text->data;
 }
 
 #ifdef __cplusplus
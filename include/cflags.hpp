@@ -27,18 +27,241 @@
 #ifndef CFLAGS_HPP
 #define CFLAGS_HPP
 
+#include <cctype>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
 #include <cstring>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <exception>
+#include <memory>
 #include <string>
+#include <stdexcept>
 #include <string_view>
+#include <tuple>
+#include <utility>
 #include <vector>
+#include <deque>
 #include <functional>
+#include <unordered_map>
+#include <variant>
+#include <thread>
+#include <charconv>
+#include <type_traits>
+
+#if defined(CFLAGS_STATS)
+    #include <chrono>
+#endif
+
+#if !defined(_WIN32)
+    #include <fcntl.h>
+    #include <sys/ioctl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+
+    #define CFLAGS_HAVE_MMAP
+#endif
+
+// CPPFLAGS_DEFINE_*(name, short_name, default_value, description) defines a flag from any translation unit as
+// a global FLAGS_name, with the long name "name", and CPPFLAGS_DECLARE_*(name) declares it for use elsewhere
+// Each definition is a constexpr flag_definition in the cflags_cpp_flags section, which the linker gathers into
+// one table, so defining a flag runs no constructor before main(), and cflags::add_static_flags() adds it
+#if defined(__ELF__) && defined(__GNUC__)
+    #define CFLAGS_HAVE_SECTIONS
+
+    // Aligned explicitly, as the compiler may over-align objects and leave gaps in the table
+    #define _CPPFLAGS_DEFINE_FLAG(cpp_type, flag_type, name, short_name, default_value, description)        \
+        cpp_type FLAGS_##name = default_value;                                                              \
+        static constexpr ::cflags::flag_definition _cflags_definition_##name                                \
+            __attribute__((used, section("cflags_cpp_flags"), aligned(alignof(::cflags::flag_definition)))) \
+            = { short_name, ::cflags::flag::type::flag_type, #name, description, &FLAGS_##name }
+
+    #define CPPFLAGS_DEFINE_STRING(name, short_name, default_value, description) \
+        _CPPFLAGS_DEFINE_FLAG(const char *, CString, name, short_name, default_value, description)
+    #define CPPFLAGS_DEFINE_BOOL(name, short_name, default_value, description) \
+        _CPPFLAGS_DEFINE_FLAG(bool, Bool, name, short_name, default_value, description)
+    #define CPPFLAGS_DEFINE_INT(name, short_name, default_value, description) \
+        _CPPFLAGS_DEFINE_FLAG(int, Int, name, short_name, default_value, description)
+    #define CPPFLAGS_DEFINE_FLOAT(name, short_name, default_value, description) \
+        _CPPFLAGS_DEFINE_FLAG(float, Float, name, short_name, default_value, description)
+#endif
+
+#define CPPFLAGS_DECLARE_STRING(name) extern const char * FLAGS_##name
+#define CPPFLAGS_DECLARE_BOOL(name)   extern bool FLAGS_##name
+#define CPPFLAGS_DECLARE_INT(name)    extern int FLAGS_##name
+#define CPPFLAGS_DECLARE_FLOAT(name)  extern float FLAGS_##name
+
+#if defined(_WIN32)
+    #define CFLAGS_ENVIRON _environ
+#else
+    extern char ** environ;
+    #define CFLAGS_ENVIRON environ
+#endif
+
+// Define CFLAGS_STATS before including cflags.hpp to collect statistics while loading and parsing
+// When it is not defined the counters do not exist, and collecting them costs nothing
+#if !defined(CFLAGS_STAT)
+    #if defined(CFLAGS_STATS)
+        #define CFLAGS_STAT(statement) statement
+    #else
+        #define CFLAGS_STAT(statement)
+    #endif
+#endif
 
 namespace cflags {
 
 using std::string;
 using std::string_view;
 using std::vector;
+using std::deque;
 using std::function;
+using std::array;
+using std::unordered_map;
+using std::unique_ptr;
+
+#if defined(CFLAGS_STATS)
+
+struct flag_stats
+{
+    // Times a lookup by name resolved to this flag
+    unsigned lookups = 0;
+
+    // Time spent in this flag's callback
+    unsigned long long callback_ns = 0;
+};
+
+// Accumulated until reset_stats()
+struct parse_stats
+{
+    // Hash table lookups, and names compared, while looking up flags
+    unsigned long long probes = 0;
+    unsigned long long comparisons = 0;
+
+    // An estimate, from the growth of the library's own index, argument arrays, and loaded files
+    // Allocations made by std::string, std::vector, and std::function members and targets, such as
+    // program, string and list values, callback arguments, and error messages, are not included
+    unsigned long long estimated_allocations = 0;
+    unsigned long long bytes_copied = 0;
+
+    unsigned long long callbacks = 0;
+
+    // Time spent in user callbacks, and the rest of the time spent in parse()
+    unsigned long long callback_ns = 0;
+    unsigned long long library_ns = 0;
+};
+
+#endif // CFLAGS_STATS
+
+// Locale independent numeric conversions, the whole value must be a valid number
+// Each returns nullptr on success, or a short description of why the value was rejected
+
+inline const char * from_string(string_view str, int& out)
+{
+    // from_chars does not accept a leading '+'
+    if (str.size() > 1 && str[0] == '+' && str[1] != '-') {
+        str.remove_prefix(1);
+    }
+
+    int value = 0;
+    const char * end = str.data() + str.size();
+    auto [ptr, ec] = std::from_chars(str.data(), end, value);
+    if (ec == std::errc::result_out_of_range) {
+        return "out of range";
+    }
+    if (ec != std::errc() || ptr != end) {
+        return "expected an integer";
+    }
+
+    out = value;
+    return nullptr;
+}
+
+inline const char * from_string(string_view str, float& out)
+{
+    if (str.size() > 1 && str[0] == '+' && str[1] != '-') {
+        str.remove_prefix(1);
+    }
+
+    float value = 0.0f;
+    const char * end = str.data() + str.size();
+
+#if defined(__cpp_lib_to_chars)
+    auto [ptr, ec] = std::from_chars(str.data(), end, value);
+    if (ec == std::errc::result_out_of_range) {
+        return "out of range";
+    }
+    if (ec != std::errc() || ptr != end) {
+        return "expected a number";
+    }
+#else
+    // Standard libraries without floating point from_chars fall back to strtof, which needs a
+    // terminated string and depends on the current locale
+    string copy(str);
+    char * ptr = nullptr;
+    errno = 0;
+    value = strtof(copy.c_str(), &ptr);
+    if (copy.empty() || ptr != copy.c_str() + copy.size() || isspace(static_cast<unsigned char>(copy[0]))) {
+        return "expected a number";
+    }
+    if (errno == ERANGE) {
+        return "out of range";
+    }
+#endif
+
+    out = value;
+    return nullptr;
+}
+
+// Split a delimited value into a list of int, float, or string_view, clearing it if any element is invalid
+// The delimiters are counted first, so the list is reserved at most once,
+// then each element is found with memchr() and converted in place
+// Views in a vector<string_view> point into the value, e.g. argv
+template <class T>
+inline const char * split_list(string_view value, char delimiter, vector<T>& list)
+{
+    list.clear();
+    if (value.empty()) {
+        return nullptr;
+    }
+
+    const char * pch = value.data();
+    const char * end = value.data() + value.size();
+
+    size_t size = 1;
+    for (auto next = pch; (next = static_cast<const char *>(memchr(next, delimiter, end - next))); ++next) {
+        ++size;
+    }
+    list.reserve(size);
+
+    while (true) {
+        auto next = static_cast<const char *>(memchr(pch, delimiter, end - pch));
+        string_view element(pch, (next ? next : end) - pch);
+
+        if constexpr (std::is_same_v<T, string_view>) {
+            list.push_back(element);
+        }
+        else {
+            T converted;
+            if (const char * error = from_string(element, converted)) {
+                list.clear();
+                return error;
+            }
+            list.push_back(converted);
+        }
+
+        if (!next) {
+            break;
+        }
+        pch = next + 1;
+    }
+
+    return nullptr;
+}
 
 struct flag
 {
@@ -52,6 +275,9 @@ public:
         Bool,
         Int,
         Float,
+        StringViewList,
+        IntList,
+        FloatList,
         StringCallback,
         CStringCallback,
         BoolCallback,
@@ -59,43 +285,137 @@ public:
         FloatCallback,
     };
 
+    // At most one callback is ever set, matching the *Callback type
+    using callback_type = std::variant<
+        std::monostate,
+        function<void(string)>,
+        function<void(const char *)>,
+        function<void(bool)>,
+        function<void(int)>,
+        function<void(float)>
+    >;
+
+    // Hot members, read on every lookup and call to process(), are kept
+    // together at the front so they share a cache line
+
     char        short_name;
-    string      long_name;
-    string      description;
+
+    // Separates the elements of list flags
+    char        delimiter;
 
     type        type;
     unsigned    count;
 
+    // Position in the schema, used to find this flag's entry in a result
+    unsigned    index;
+
     union {
         string *        string_ptr;
         const char **   cstring_ptr;
         bool *          bool_ptr;
         int *           int_ptr;
         float *         float_ptr;
+
+        vector<string_view> *   string_view_list_ptr;
+        vector<int> *           int_list_ptr;
+        vector<float> *         float_list_ptr;
     };
 
-    function<void(string)>          string_callback;
-    function<void(const char *)>    cstring_callback;
-    function<void(bool)>            bool_callback;
-    function<void(int)>             int_callback;
-    function<void(float)>           float_callback;
+    string      long_name;
+
+    // Cold members, only read when a callback fires or usage is printed
+
+    callback_type   callback;
+
+    string      description;
+
+#if defined(CFLAGS_STATS)
+    flag_stats  stats;
+#endif
 
     flag()
         : short_name('\0')
+        , delimiter(',')
         , type(type::Undefined)
         , count(0)
+        , index(0)
         , string_ptr(nullptr) // This will set all of the *_ptr members
     { }
 
-    inline void process(const char * value)
+    static bool parse_bool(string_view str)
     {
-        auto parse_bool = [](string_view str) {
-            return !(
-                str == "false" ||
-                str == "FALSE" ||
-                str == "0"
-            );
-        };
+        return !(
+            str == "false" ||
+            str == "FALSE" ||
+            str == "0"
+        );
+    }
+
+    // Validate a value without storing it or calling any callback
+    // Returns nullptr on success, or a short description of why the value was rejected
+    inline const char * check(const char * value) const
+    {
+        int int_value = 0;
+        float float_value = 0.0f;
+
+        switch (type) {
+        case type::Int:
+        case type::IntCallback:
+            return from_string(value, int_value);
+        case type::Float:
+        case type::FloatCallback:
+            return from_string(value, float_value);
+        case type::IntList:
+        case type::FloatList: {
+            // An empty value is an empty list, as in split_list()
+            string_view rest = value;
+            if (rest.empty()) {
+                return nullptr;
+            }
+            for (;;) {
+                size_t next = rest.find(delimiter);
+                string_view element = rest.substr(0, next);
+                const char * error = (type == type::IntList
+                    ? from_string(element, int_value)
+                    : from_string(element, float_value));
+                if (error || next == string_view::npos) {
+                    return error;
+                }
+                rest.remove_prefix(next + 1);
+            }
+        }
+        default:
+            return nullptr;
+        }
+    }
+
+    // Returns nullptr on success, or a short description of why the value was rejected
+    inline const char * process(const char * value)
+    {
+        int int_value = 0;
+        float float_value = 0.0f;
+        if (value) {
+            const char * error = nullptr;
+            if (type == type::Int || type == type::IntCallback) {
+                error = from_string(value, int_value);
+            }
+            else if (type == type::Float || type == type::FloatCallback) {
+                error = from_string(value, float_value);
+            }
+            else if (type == type::StringViewList && string_view_list_ptr) {
+                error = process_list(value, *string_view_list_ptr);
+            }
+            else if (type == type::IntList && int_list_ptr) {
+                error = process_list(value, *int_list_ptr);
+            }
+            else if (type == type::FloatList && float_list_ptr) {
+                error = process_list(value, *float_list_ptr);
+            }
+
+            if (error) {
+                return error;
+            }
+        }
 
         ++count;
 
@@ -106,9 +426,9 @@ public:
             }
             break;
         case type::StringCallback:
-            if (string_callback) {
+            if (auto string_callback = std::get_if<function<void(string)>>(&callback); string_callback && *string_callback) {
                 if (value) {
-                    string_callback(value);
+                    (*string_callback)(value);
                 }
             }
             break;
@@ -118,8 +438,8 @@ public:
             }
             break;
         case type::CStringCallback:
-            if (cstring_callback) {
-                cstring_callback(value);
+            if (auto cstring_callback = std::get_if<function<void(const char *)>>(&callback); cstring_callback && *cstring_callback) {
+                (*cstring_callback)(value);
             }
             break;
         case type::Bool:
@@ -133,352 +453,3202 @@ public:
             }
             break;
         case type::BoolCallback:
-            if (bool_callback) {
+            if (auto bool_callback = std::get_if<function<void(bool)>>(&callback); bool_callback && *bool_callback) {
                 if (value) {
-                    bool_callback(parse_bool(value));
+                    (*bool_callback)(parse_bool(value));
                 }
                 else {
-                    bool_callback(true);
+                    (*bool_callback)(true);
                 }
             }
             break;
         case type::Int:
             if (int_ptr) {
                 if (value) {
-                    *int_ptr = strtol(value, nullptr, 10);
+                    *int_ptr = int_value;
                 }
             }
             break;
         case type::IntCallback:
-            if (int_callback) {
+            if (auto int_callback = std::get_if<function<void(int)>>(&callback); int_callback && *int_callback) {
                 if (value) {
-                    int_callback(strtol(value, nullptr, 10));
+                    (*int_callback)(int_value);
                 }
             }
             break;
         case type::Float:
             if (float_ptr) {
                 if (value) {
-                    *float_ptr = strtof(value, nullptr);
+                    *float_ptr = float_value;
                 }
             }
             break;
         case type::FloatCallback:
-            if (float_callback) {
+            if (auto float_callback = std::get_if<function<void(float)>>(&callback); float_callback && *float_callback) {
                 if (value) {
-                    float_callback(strtof(value, nullptr));
+                    (*float_callback)(float_value);
                 }
             }
             break;
         default: ;
         }
+
+        return nullptr;
+    }
+
+    template <class T>
+    inline const char * process_list(string_view value, vector<T>& list) const
+    {
+        return split_list(value, delimiter, list);
     }
 
 };
 
-class cflags
+// Guard against the flag growing again, e.g. by adding another callback member
+// The hot members take at most one cache line, followed by the callback and description
+static_assert(
+    sizeof(flag) <= 64 + sizeof(flag::callback_type) + sizeof(string)
+#if defined(CFLAGS_STATS)
+        + sizeof(flag_stats)
+#endif
+    , "cflags::flag has grown beyond its hot/cold layout budget"
+);
+
+// A flag defined with CPPFLAGS_DEFINE_*(), kept as constant data until cflags::add_static_flags() adds it
+// value points to a const char *, bool, int, or float, matching type
+struct flag_definition
 {
-public:
+    char            short_name;
+    enum flag::type type;
+    const char *    long_name;
+    const char *    description;
+    void *          value;
+};
 
-    string program;
-    vector<string_view> args;
+#if defined(CFLAGS_HAVE_SECTIONS)
+extern "C" const flag_definition __start_cflags_cpp_flags[] __attribute__((weak, visibility("hidden")));
+extern "C" const flag_definition __stop_cflags_cpp_flags[] __attribute__((weak, visibility("hidden")));
+#endif
 
-    int argc;
-    char ** argv;
+///
+/// Identifies a file and the version of its contents, so that an unchanged file can be recognized
+/// Every field is zero where files cannot be identified
+///
+struct file_id
+{
+    unsigned long long device = 0;
+    unsigned long long inode = 0;
+    unsigned long long size = 0;
+    unsigned long long modified_ns = 0;
 
-    cflags()
-        : argc(0)
-        , argv(nullptr)
+#if defined(CFLAGS_HAVE_MMAP)
+    explicit file_id(const struct stat& st)
+        : device(static_cast<unsigned long long>(st.st_dev))
+        , inode(static_cast<unsigned long long>(st.st_ino))
+        , size(static_cast<unsigned long long>(st.st_size))
+#if defined(__APPLE__)
+        , modified_ns(static_cast<unsigned long long>(st.st_mtimespec.tv_sec) * 1000000000ull + static_cast<unsigned long long>(st.st_mtimespec.tv_nsec))
+#else
+        , modified_ns(static_cast<unsigned long long>(st.st_mtim.tv_sec) * 1000000000ull + static_cast<unsigned long long>(st.st_mtim.tv_nsec))
+#endif
     { }
+#endif
 
-    flag * add_flag(flag && flag)
-    {
-        _flags.push_back(flag);
-        return &_flags.back();
-    }
+    file_id() = default;
 
-    flag * add_string(char short_name, string long_name, string * value_ptr, string description)
+    // Returns a zero id if the file cannot be identified
+    static file_id of(const char * path)
     {
-        flag flag;
-        flag.short_name = short_name;
-        flag.long_name = long_name;
-        flag.type = flag::type::String;
-        flag.string_ptr = value_ptr;
-        flag.description = description;
-
-        _flags.push_back(flag);
-        return &_flags.back();
+#if defined(CFLAGS_HAVE_MMAP)
+        struct stat st;
+        if (stat(path, &st) == 0) {
+            return file_id(st);
+        }
+#else
+        (void)path;
+#endif
+        return file_id();
     }
-    
-    flag * add_cstring(char short_name, string long_name, const char ** value_ptr, string description)
-    {
-        flag flag;
-        flag.short_name = short_name;
-        flag.long_name = long_name;
-        flag.type = flag::type::CString;
-        flag.cstring_ptr = value_ptr;
-        flag.description = description;
 
-        _flags.push_back(flag);
-        return &_flags.back();
-    }
-    
-    flag * add_bool(char short_name, string long_name, bool * value_ptr, string description)
+    bool valid() const
     {
-        flag flag;
-        flag.short_name = short_name;
-        flag.long_name = long_name;
-        flag.type = flag::type::Bool;
-        flag.bool_ptr = value_ptr;
-        flag.description = description;
-
-        _flags.push_back(flag);
-        return &_flags.back();
+        return (device != 0 || inode != 0);
     }
-    
-    flag * add_int(char short_name, string long_name, int * value_ptr, string description)
-    {
-        flag flag;
-        flag.short_name = short_name;
-        flag.long_name = long_name;
-        flag.type = flag::type::Int;
-        flag.int_ptr = value_ptr;
-        flag.description = description;
 
-        _flags.push_back(flag);
-        return &_flags.back();
-    }
-    
-    flag * add_float(char short_name, string long_name, float * value_ptr, string description)
+    bool same_file(const file_id& other) const
     {
-        flag flag;
-        flag.short_name = short_name;
-        flag.long_name = long_name;
-        flag.type = flag::type::Float;
-        flag.float_ptr = value_ptr;
-        flag.description = description;
-
-        _flags.push_back(flag);
-        return &_flags.back();
+        return (device == other.device && inode == other.inode);
     }
 
-    flag * add_string_callback(char short_name, string long_name, function<void(string)> callback, string description)
+    bool operator==(const file_id& other) const
     {
-        flag flag;
-        flag.short_name = short_name;
-        flag.long_name = long_name;
-        flag.type = flag::type::StringCallback;
-        flag.string_callback = callback;
-        flag.description = description;
-
-        _flags.push_back(flag);
-        return &_flags.back();
+        return same_file(other) && size == other.size && modified_ns == other.modified_ns;
     }
+};
 
-    flag * add_cstring_callback(char short_name, string long_name, function<void(const char *)> callback, string description)
-    {
-        flag flag;
-        flag.short_name = short_name;
-        flag.long_name = long_name;
-        flag.type = flag::type::CStringCallback;
-        flag.cstring_callback = callback;
-        flag.description = description;
-
-        _flags.push_back(flag);
-        return &_flags.back();
-    }
+///
+/// The contents of a file, mapped with mmap() or read into memory where that is unavailable
+/// There is one writable byte past the end of the data, so the last token can be terminated in place
+///
+class mapped_file
+{
+public:
 
-    flag * add_bool_callback(char short_name, string long_name, function<void(bool)> callback, string description)
-    {
-        flag flag;
-        flag.short_name = short_name;
-        flag.long_name = long_name;
-        flag.type = flag::type::BoolCallback;
-        flag.bool_callback = callback;
-        flag.description = description;
+    mapped_file() = default;
 
-        _flags.push_back(flag);
-        return &_flags.back();
-    }
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
 
-    flag * add_int_callback(char short_name, string long_name, function<void(int)> callback, string description)
+    ~mapped_file()
     {
-        flag flag;
-        flag.short_name = short_name;
-        flag.long_name = long_name;
-        flag.type = flag::type::IntCallback;
-        flag.int_callback = callback;
-        flag.description = description;
-
-        _flags.push_back(flag);
-        return &_flags.back();
+        close();
     }
 
-    flag * add_float_callback(char short_name, string long_name, function<void(float)> callback, string description)
+    bool open(const char * path)
     {
-        flag flag;
-        flag.short_name = short_name;
-        flag.long_name = long_name;
-        flag.type = flag::type::FloatCallback;
-        flag.float_callback = callback;
-        flag.description = description;
+        close();
 
-        _flags.push_back(flag);
-        return &_flags.back();
-    }
+#if defined(CFLAGS_HAVE_MMAP)
 
-    ///
-    ///
-    ///
-    inline bool parse(int main_argc, char * main_argv[])
-    {
-        argc = main_argc;
-        argv = main_argv;
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
 
-        program = argv[0];
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
 
-        bool passthrough = false;
-        for (int i = 1; i < argc; ++i) {
-            char * pch = argv[i];
-            if (!passthrough && *pch == '-') {
-                ++pch;
-                if (*pch == '-') {
-                    ++pch;
+        _id = file_id(st);
+        _size = static_cast<size_t>(st.st_size);
 
-                    if (*pch == '\0') {
-                        // All following flags are not to be processed
-                        passthrough = true;
-                        continue;
-                    }
+        // The remainder of the last page is zero filled and, being a private mapping, writable
+        // If the file ends exactly on a page boundary there is no spare byte, so read it instead
+        long page_size = sysconf(_SC_PAGESIZE);
+        if (_size > 0 && page_size > 0 && _size % static_cast<size_t>(page_size) != 0) {
+            void * data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                _data = static_cast<char *>(data);
+                _mapped = true;
+            }
+        }
 
-                    // Long
-                    char * key = pch;
-                    char * value = NULL;
+        if (!_mapped) {
+            _data = static_cast<char *>(malloc(_size + 1));
+            size_t offset = 0;
+            while (_data && offset < _size) {
+                ssize_t result = read(fd, _data + offset, _size - offset);
+                if (result <= 0) {
+                    break;
+                }
+                offset += static_cast<size_t>(result);
+            }
+            _size = offset;
+        }
 
-                    char * divider = strchr(pch, '=');
-                    if (divider) {
-                        *divider = '\0';
-                        value = divider + 1;
-                    }
+        ::close(fd);
 
-                    bool next_arg_is_value = (i + 1 < argc && argv[i + 1][0] != '-');
+#else
 
-                    bool found = false;
-                    for (auto& flag : _flags) {
-                        if (flag.long_name == key) {
-                            found = true;
+        FILE * file = fopen(path, "rb");
+        if (!file) {
+            return false;
+        }
 
-                            if (value) {
-                                flag.process(value);
-                            }
-                            else if (next_arg_is_value) {
-                                flag.process(argv[i + 1]);
-                                ++i;
-                            }
-                            else if (flag.type == flag::type::Bool || flag.type == flag::type::BoolCallback) {
-                                flag.process(nullptr);
-                            }
-                            else {
-                                fprintf(stderr, "%s: option '--%s' requires an value\n", program.c_str(), key);
-                                return false;
-                            }
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
 
-                            break;
-                        }
-                    }
+        _data = static_cast<char *>(malloc((size > 0 ? static_cast<size_t>(size) : 0) + 1));
+        if (_data && size > 0) {
+            _size = fread(_data, 1, static_cast<size_t>(size), file);
+        }
 
-                    if (!found) {
-                        fprintf(stderr, "%s: unrecognized option '--%s'\n", program.c_str(), key);
-                        return false;
-                    }
-                }
-                else {
-                    // Short
-                    while (*pch) {
-                        bool is_last_short_flag = (*(pch + 1) == '\0');
-                        bool next_arg_is_value = (i + 1 < argc && argv[i + 1][0] != '-');
-
-                        bool found = false;
-                        for (flag& flag : _flags) {
-                            if (flag.short_name == *pch) {
-                                found = true;
-
-                                if (is_last_short_flag && next_arg_is_value) {
-                                    flag.process(argv[i + 1]);
-                                    ++i;
-                                }
-                                else if (flag.type == flag::type::Bool || flag.type == flag::type::BoolCallback) {
-                                    flag.process(nullptr);
-                                }
-                                else {
-                                    fprintf(stderr, "%s: option '-%c' requires an value\n", program.c_str(), *pch);
-                                    return false;
-                                }
-
-                                break;
-                            }
-                        }
+        fclose(file);
 
-                        if (!found) {
-                            fprintf(stderr, "%s: unrecognized option '-%c'\n", program.c_str(), *pch);
-                            return false;
-                        }
+#endif
 
-                        ++pch;
-                    }
-                }
-            }
-            else {
-                args.push_back(pch);
-                _argv.push_back(pch);
-            }
+        return (_data != nullptr);
+    }
+
+    void close()
+    {
+#if defined(CFLAGS_HAVE_MMAP)
+        if (_mapped) {
+            munmap(_data, _size);
         }
+        else {
+            free(_data);
+        }
+#else
+        free(_data);
+#endif
 
-        argc = static_cast<int>(_argv.size());
-        argv = _argv.data();
+        _data = nullptr;
+        _size = 0;
+        _mapped = false;
+        _id = file_id();
+    }
 
-        return true;
+    char * data() const
+    {
+        return _data;
     }
 
-    void print_usage(const string& usage, const string& above, const string& below)
+    size_t size() const
     {
-        printf("Usage: %s %s\n", program.c_str(), usage.c_str());
-        printf("%s\n\n", above.c_str());
+        return _size;
+    }
 
+    // The file and version that was opened
+    const file_id& id() const
+    {
+        return _id;
+    }
+
+private:
+
+    char * _data = nullptr;
+    size_t _size = 0;
+    bool _mapped = false;
+
+    file_id _id;
+
+};
+
+///
+/// The long names that may be suggested for a misspelt one, grouped by length and sorted within each length
+/// Only the lengths within reach of the misspelt name are scanned, and names that share a prefix are adjacent,
+/// so the edit distance of the shared characters is computed once for all of them
+///
+class suggestion_index
+{
+public:
+
+    // Suggestions are at most 3 edits from a pattern cut to 64 characters, so longer names are never suggested
+    static constexpr size_t max_name_size = 64 + 3;
+
+    static constexpr size_t max_suggestions = 3;
+
+    void clear()
+    {
+        _entries.clear();
+        _offsets.fill(0);
+    }
+
+    // Add names in any order with add(), then call sort() before suggest()
+    // Where names tie, those with the lowest order are suggested, in that order
+    void add(string_view name, unsigned order)
+    {
+        if (!name.empty() && name.size() <= max_name_size) {
+            _entries.push_back({ name, order, 0 });
+        }
+    }
+
+    void sort()
+    {
+        std::sort(_entries.begin(), _entries.end(), _compare);
+
+        _offsets.fill(0);
+        for (auto& entry : _entries) {
+            ++_offsets[entry.name.size() + 1];
+        }
+        for (size_t size = 1; size < _offsets.size(); ++size) {
+            _offsets[size] += _offsets[size - 1];
+        }
+
+        for (size_t i = 0; i < _entries.size(); ++i) {
+            _share(i);
+        }
+    }
+
+    // Add a name to a sorted index
+    void insert(string_view name, unsigned order)
+    {
+        if (name.empty() || name.size() > max_name_size) {
+            return;
+        }
+
+        entry added{ name, order, 0 };
+        auto it = std::lower_bound(_entries.begin() + _offsets[name.size()], _entries.begin() + _offsets[name.size() + 1], added, _compare);
+        size_t index = static_cast<size_t>(it - _entries.begin());
+        _entries.insert(it, added);
+        for (size_t size = name.size() + 1; size < _offsets.size(); ++size) {
+            ++_offsets[size];
+        }
+
+        _share(index);
+        if (index + 1 < _entries.size()) {
+            _share(index + 1);
+        }
+    }
+
+    // Finish an "unrecognized option" message with the closest names, if any are close enough
+    string suggest(string_view name, string_view dashes = "--") const
+    {
+        search_state search;
+
+        // Only the first 64 characters fit in a word, which is more than any real flag name
+        string_view pattern = name.substr(0, 64);
+        if (pattern.size() < 2) {
+            return string();
+        }
+        search.pattern_size = pattern.size();
+        size_t max_distance = std::clamp<size_t>(pattern.size() / 3, 1, 3);
+
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            search.peq[static_cast<unsigned char>(pattern[i])] |= uint64_t(1) << i;
+        }
+
+        // A suggestion must be within max_distance, and closer than retyping the whole name
+        size_t limit = std::min(max_distance + 1, pattern.size());
+        search.best = limit;
+
+        // Lengths nearest the pattern's are scanned first, as a close name found early abandons more prefixes
+        for (size_t offset = 0; offset < search.best; ++offset) {
+            if (offset < pattern.size()) {
+                _scan(search, pattern.size() - offset);
+            }
+            if (offset > 0 && offset < search.best && pattern.size() + offset <= max_name_size) {
+                _scan(search, pattern.size() + offset);
+            }
+        }
+
+        if (search.best < limit) {
+            search.collect = true;
+            size_t first = (pattern.size() > search.best ? pattern.size() - search.best : 1);
+            for (size_t size = first; size <= pattern.size() + search.best && size <= max_name_size; ++size) {
+                _scan(search, size);
+            }
+        }
+
+        string message;
+        for (size_t i = 0; i < search.found_count; ++i) {
+            message += (i == 0 ? "; did you mean '" : ", '");
+            message += dashes;
+            message += search.found[i]->name;
+            message += '\'';
+        }
+        if (search.found_count > 0) {
+            message += '?';
+        }
+        return message;
+    }
+
+private:
+
+    // shared is how many leading characters the name has in common with the one before it of the same size
+    struct entry
+    {
+        string_view name;
+        unsigned order;
+        unsigned char shared;
+    };
+
+    // A column of Myers' bit-parallel edit distance, in Hyyrö's formulation, between a pattern of up to 64 characters
+    // and the first characters of a name, where bit i of pv or mv is set if row i + 1 is one more or one less than row i
+    // Each character of the name costs a handful of word operations, rather than a column of the full matrix
+    struct column
+    {
+        uint64_t pv;
+        uint64_t mv;
+        size_t distance;
+    };
+
+    // The smallest distance is found first, and then the names at it are collected
+    struct search_state
+    {
+        array<uint64_t, 256> peq = {};
+        size_t pattern_size = 0;
+        size_t best = 0;
+        bool collect = false;
+
+        array<const entry *, max_suggestions> found = {};
+        size_t found_count = 0;
+
+        bool within(size_t distance) const
+        {
+            return (collect ? distance <= best : distance < best);
+        }
+
+        void visit(const entry& candidate, size_t distance)
+        {
+            if (!collect) {
+                best = std::min(best, distance);
+                return;
+            }
+            if (distance != best) {
+                return;
+            }
+
+            // Keep the names with the lowest order, sorted by it
+            size_t i = found_count;
+            if (i == found.size()) {
+                if (found[i - 1]->order < candidate.order) {
+                    return;
+                }
+                --i;
+            }
+            else {
+                ++found_count;
+            }
+            for (; i > 0 && found[i - 1]->order > candidate.order; --i) {
+                found[i] = found[i - 1];
+            }
+            found[i] = &candidate;
+        }
+    };
+
+    static bool _compare(const entry& lhs, const entry& rhs)
+    {
+        return (lhs.name.size() != rhs.name.size() ? lhs.name.size() < rhs.name.size() : lhs.name < rhs.name);
+    }
+
+    void _share(size_t index)
+    {
+        entry& current = _entries[index];
+        current.shared = 0;
+        if (index > 0 && _entries[index - 1].name.size() == current.name.size()) {
+            string_view previous = _entries[index - 1].name;
+            while (previous[current.shared] == current.name[current.shared]) {
+                ++current.shared;
+            }
+        }
+    }
+
+    // Extend a column by one character of the name, where eq has a bit for each position of that character in the pattern
+    static column _step(column current, uint64_t eq, uint64_t last)
+    {
+        uint64_t xv = eq | current.mv;
+        uint64_t xh = (((eq & current.pv) + current.pv) ^ current.pv) | eq;
+        uint64_t ph = current.mv | ~(xh | current.pv);
+        uint64_t mh = current.pv & xh;
+
+        if (ph & last) {
+            ++current.distance;
+        }
+        else if (mh & last) {
+            --current.distance;
+        }
+
+        // The first row counts insertions, so it grows by one for every character of the name
+        ph = (ph << 1) | 1;
+        mh <<= 1;
+        current.pv = mh | ~(xv | ph);
+        current.mv = ph & xv;
+        return current;
+    }
+
+    // The smallest row of the column after depth characters, which bounds the distance of every name starting with them
+    static size_t _lowest(const column& current, size_t depth, size_t pattern_size)
+    {
+        size_t row = depth;
+        size_t lowest = depth;
+        for (size_t i = 0; i < pattern_size && lowest > 0; ++i) {
+            row = row + ((current.pv >> i) & 1) - ((current.mv >> i) & 1);
+            lowest = std::min(lowest, row);
+        }
+        return lowest;
+    }
+
+    // The end of the names from first that start with prefix, where the name before first does
+    // Names are sorted, so the run is found by galloping and then a binary search, and a short run stays cheap
+    size_t _skip(size_t first, size_t end, string_view prefix) const
+    {
+        if (first == end || _entries[first].shared < prefix.size()) {
+            return first;
+        }
+
+        // Every name in the range is as long as the prefix's name, so only the prefix is compared
+        auto starts = [&](const entry& other) { return memcmp(other.name.data(), prefix.data(), prefix.size()) == 0; };
+        size_t low = first + 1;
+        size_t high = end;
+        for (size_t step = 1; low < end; step *= 2) {
+            size_t probe = std::min(low + step - 1, end - 1);
+            if (!starts(_entries[probe])) {
+                high = probe;
+                break;
+            }
+            low = probe + 1;
+        }
+        return static_cast<size_t>(std::partition_point(_entries.begin() + low, _entries.begin() + high, starts) - _entries.begin());
+    }
+
+    // Visit every name of the given size that its prefix does not rule out
+    // The columns of the characters a name shares with the one before it are kept, and a prefix is abandoned,
+    // with every name that starts with it, once no row of its column is within reach
+    void _scan(search_state& search, size_t size) const
+    {
+        size_t end = _offsets[size + 1];
+        uint64_t last = uint64_t(1) << (search.pattern_size - 1);
+
+        array<column, max_name_size + 1> columns;
+        columns[0] = { ~uint64_t(0), 0, search.pattern_size };
+        size_t valid = 0;
+
+        for (size_t i = _offsets[size]; i < end;) {
+            const entry& candidate = _entries[i++];
+            size_t depth = std::min<size_t>(candidate.shared, valid);
+            bool reachable = true;
+            while (depth < size && reachable) {
+                columns[depth + 1] = _step(columns[depth], search.peq[static_cast<unsigned char>(candidate.name[depth])], last);
+                ++depth;
+                reachable = search.within(_lowest(columns[depth], depth, search.pattern_size));
+            }
+            valid = depth;
+
+            if (reachable) {
+                search.visit(candidate, columns[size].distance);
+            }
+            else {
+                i = _skip(i, end, candidate.name.substr(0, depth));
+            }
+        }
+    }
+
+    vector<entry> _entries;
+
+    // The names of size n are from _offsets[n] up to _offsets[n + 1]
+    array<size_t, max_name_size + 2> _offsets = {};
+
+};
+
+class schema;
+
+///
+/// The outcome of schema::parse(), holding the last value and number of occurrences of each flag,
+/// and the positional arguments
+/// Values are views into the parsed arguments, so they must outlive the result
+///
+class result
+{
+public:
+
+    // Empty when parsing succeeded, otherwise the same message cflags::parse() would print
+    string error;
+
+    string_view program;
+    vector<string_view> args;
+
+    explicit operator bool() const
+    {
+        return error.empty();
+    }
+
+    inline unsigned count(string_view long_name) const;
+
+    inline unsigned count(const flag * flag) const;
+
+    // The last value given for a flag, or nullptr if it was not given or had no value, e.g. `--verbose`
+    inline const char * value(string_view long_name) const;
+
+    inline const char * value(const flag * flag) const;
+
+    ///
+    /// Convert the last value given for a flag to bool, int, float, string, string_view, const char *,
+    /// or a vector of int, float, or string_view, returning fallback if it was not given or is invalid
+    /// A bool flag given without a value is true
+    /// int and float values are converted on the first call and cached, so a result that is
+    /// shared between threads must not be read with get() concurrently
+    ///
+    template <class T>
+    T get(string_view long_name, T fallback = T()) const;
+
+    template <class T>
+    T get(const flag * flag, T fallback = T()) const;
+
+    ///
+    /// As get(), but returns a short description of why the value was rejected, or nullptr on success
+    /// `out` is left unchanged if the flag was not given, or the value is invalid
+    ///
+    template <class T>
+    const char * try_get(string_view long_name, T& out) const;
+
+    template <class T>
+    const char * try_get(const flag * flag, T& out) const;
+
+private:
+
+    friend class schema;
+    friend class cflags;
+
+    enum class cache : unsigned char
+    {
+        none,
+        int_value,
+        float_value,
+    };
+
+    struct entry
+    {
+        unsigned count = 0;
+        const char * value = nullptr;
+
+        mutable cache cached = cache::none;
+        mutable int cached_int = 0;
+        mutable float cached_float = 0.0f;
+
+        void set(const char * new_value)
+        {
+            ++count;
+            value = new_value;
+            cached = cache::none;
+        }
+    };
+
+    const schema * _schema = nullptr;
+
+    // Indexed by flag::index
+    vector<entry> _entries;
+
+    // Used by schema::parse_cmdline() to build argv, and to hold an unterminated final argument
+    // The argument is shared, so views into it survive the result being copied or moved
+    vector<const char *> _cmdline_argv;
+    std::shared_ptr<const string> _cmdline_tail;
+
+    inline const entry * _find(const flag * flag) const;
+
+};
+
+///
+/// The flag definitions and lookup tables, without any per-parse state
+/// Once frozen, a schema can be shared, and parsed with from any number of threads at once
+///
+class schema
+{
+public:
+
+    schema() = default;
+
+    // The lookup tables point into this object's own storage
+    schema(const schema&) = delete;
+    schema& operator=(const schema&) = delete;
+
+    schema(schema&&) = default;
+    schema& operator=(schema&&) = default;
+
+    // Only record each flag's last value and count while parsing, without validating or converting it
+    // Values are then converted when they are read with get(), and invalid values are only found then
+    bool lazy = false;
+
+    // Accept any unambiguous prefix of a long name on the command line, such as --verb for --verbose
+    // Set this before freeze(), which builds the index it needs
+    bool prefix_matching = false;
+
+    ///
+    /// The returned pointer remains valid for the lifetime of this object
+    ///
+    flag * add_flag(flag && flag)
+    {
+        flag.index = static_cast<unsigned>(_flags.size());
+        _flags.push_back(std::move(flag));
+        ++_revision;
+
+        // Existing flags never move, so a frozen index only needs the new entry
+        if (_frozen) {
+            _index_flag(_flags.back());
+            if (_find_long(_flags.back().long_name) == &_flags.back()) {
+                if (prefix_matching || _sort_names) {
+                    auto it = std::lower_bound(_prefix_index.begin(), _prefix_index.end(), &_flags.back(), _compare_long_names);
+                    _prefix_index.insert(it, &_flags.back());
+                }
+                _suggestions.insert(_flags.back().long_name, _flags.back().index);
+            }
+        }
+        return &_flags.back();
+    }
+
+    flag * add_string(char short_name, string long_name, string * value_ptr, string description)
+    {
+        flag flag;
+        flag.short_name = short_name;
+        flag.long_name = std::move(long_name);
+        flag.type = flag::type::String;
+        flag.string_ptr = value_ptr;
+        flag.description = std::move(description);
+
+        return add_flag(std::move(flag));
+    }
+    
+    flag * add_cstring(char short_name, string long_name, const char ** value_ptr, string description)
+    {
+        flag flag;
+        flag.short_name = short_name;
+        flag.long_name = std::move(long_name);
+        flag.type = flag::type::CString;
+        flag.cstring_ptr = value_ptr;
+        flag.description = std::move(description);
+
+        return add_flag(std::move(flag));
+    }
+    
+    flag * add_bool(char short_name, string long_name, bool * value_ptr, string description)
+    {
+        flag flag;
+        flag.short_name = short_name;
+        flag.long_name = std::move(long_name);
+        flag.type = flag::type::Bool;
+        flag.bool_ptr = value_ptr;
+        flag.description = std::move(description);
+
+        return add_flag(std::move(flag));
+    }
+    
+    flag * add_int(char short_name, string long_name, int * value_ptr, string description)
+    {
+        flag flag;
+        flag.short_name = short_name;
+        flag.long_name = std::move(long_name);
+        flag.type = flag::type::Int;
+        flag.int_ptr = value_ptr;
+        flag.description = std::move(description);
+
+        return add_flag(std::move(flag));
+    }
+    
+    flag * add_float(char short_name, string long_name, float * value_ptr, string description)
+    {
+        flag flag;
+        flag.short_name = short_name;
+        flag.long_name = std::move(long_name);
+        flag.type = flag::type::Float;
+        flag.float_ptr = value_ptr;
+        flag.description = std::move(description);
+
+        return add_flag(std::move(flag));
+    }
+
+    ///
+    /// The list is cleared, and its values replaced each time the flag is processed
+    /// Views in a string_view list point into the parsed arguments, so they must outlive it
+    ///
+    flag * add_string_view_list(char short_name, string long_name, vector<string_view> * value_ptr, string description, char delimiter = ',')
+    {
+        flag flag;
+        flag.short_name = short_name;
+        flag.delimiter = delimiter;
+        flag.long_name = std::move(long_name);
+        flag.type = flag::type::StringViewList;
+        flag.string_view_list_ptr = value_ptr;
+        flag.description = std::move(description);
+
+        return add_flag(std::move(flag));
+    }
+
+    flag * add_int_list(char short_name, string long_name, vector<int> * value_ptr, string description, char delimiter = ',')
+    {
+        flag flag;
+        flag.short_name = short_name;
+        flag.delimiter = delimiter;
+        flag.long_name = std::move(long_name);
+        flag.type = flag::type::IntList;
+        flag.int_list_ptr = value_ptr;
+        flag.description = std::move(description);
+
+        return add_flag(std::move(flag));
+    }
+
+    flag * add_float_list(char short_name, string long_name, vector<float> * value_ptr, string description, char delimiter = ',')
+    {
+        flag flag;
+        flag.short_name = short_name;
+        flag.delimiter = delimiter;
+        flag.long_name = std::move(long_name);
+        flag.type = flag::type::FloatList;
+        flag.float_list_ptr = value_ptr;
+        flag.description = std::move(description);
+
+        return add_flag(std::move(flag));
+    }
+
+    flag * add_string_callback(char short_name, string long_name, function<void(string)> callback, string description)
+    {
+        flag flag;
+        flag.short_name = short_name;
+        flag.long_name = std::move(long_name);
+        flag.type = flag::type::StringCallback;
+        flag.callback = std::move(callback);
+        flag.description = std::move(description);
+
+        return add_flag(std::move(flag));
+    }
+
+    flag * add_cstring_callback(char short_name, string long_name, function<void(const char *)> callback, string description)
+    {
+        flag flag;
+        flag.short_name = short_name;
+        flag.long_name = std::move(long_name);
+        flag.type = flag::type::CStringCallback;
+        flag.callback = std::move(callback);
+        flag.description = std::move(description);
+
+        return add_flag(std::move(flag));
+    }
+
+    flag * add_bool_callback(char short_name, string long_name, function<void(bool)> callback, string description)
+    {
+        flag flag;
+        flag.short_name = short_name;
+        flag.long_name = std::move(long_name);
+        flag.type = flag::type::BoolCallback;
+        flag.callback = std::move(callback);
+        flag.description = std::move(description);
+
+        return add_flag(std::move(flag));
+    }
+
+    flag * add_int_callback(char short_name, string long_name, function<void(int)> callback, string description)
+    {
+        flag flag;
+        flag.short_name = short_name;
+        flag.long_name = std::move(long_name);
+        flag.type = flag::type::IntCallback;
+        flag.callback = std::move(callback);
+        flag.description = std::move(description);
+
+        return add_flag(std::move(flag));
+    }
+
+    flag * add_float_callback(char short_name, string long_name, function<void(float)> callback, string description)
+    {
+        flag flag;
+        flag.short_name = short_name;
+        flag.long_name = std::move(long_name);
+        flag.type = flag::type::FloatCallback;
+        flag.callback = std::move(callback);
+        flag.description = std::move(description);
+
+        return add_flag(std::move(flag));
+    }
+
+    ///
+    /// Build the long name and short name lookup tables
+    /// Flags added afterwards are indexed as they are added, and an unfrozen schema falls back to a linear search
+    ///
+    void freeze()
+    {
+        _long_index.clear();
+        _long_index.reserve(_flags.size());
+        _short_index.fill(nullptr);
+
+        for (auto& flag : _flags) {
+            _index_flag(flag);
+        }
+
+        // Only the flag that wins each name is a prefix candidate
+        _prefix_index.clear();
+        if (prefix_matching || _sort_names) {
+            _prefix_index.reserve(_long_index.size());
+            for (auto& entry : _long_index) {
+                _prefix_index.push_back(entry.second);
+            }
+            std::sort(_prefix_index.begin(), _prefix_index.end(), _compare_long_names);
+        }
+
+        _suggestions.clear();
+        for (auto& entry : _long_index) {
+            _suggestions.add(entry.first, entry.second->index);
+        }
+        _suggestions.sort();
+
+        _frozen = true;
+    }
+
+    const flag * find_long(string_view long_name) const
+    {
+        return _find_long(long_name);
+    }
+
+    const flag * find_short(char short_name) const
+    {
+        return _find_short(short_name);
+    }
+
+    ///
+    /// Parse without writing to any flag or calling any callback, so this is safe to call from many
+    /// threads at once, as long as no flags are added in the meantime
+    ///
+    result parse(int argc, const char * const * argv) const
+    {
+        result result;
+        parse(argc, argv, result);
+        return result;
+    }
+
+    ///
+    /// Parse into an existing result, reusing its storage
+    ///
+    bool parse(int argc, const char * const * argv, result& result) const
+    {
+        result._schema = this;
+        result.error.clear();
+        result.args.clear();
+        result._entries.assign(_flags.size(), result::entry());
+        result.program = argv[0];
+
+        struct handler
+        {
+            const schema& owner;
+            class result& out;
+
+            const flag * find_long(string_view long_name) const
+            {
+                return owner._find_long(long_name);
+            }
+
+            const flag * find_short(char short_name) const
+            {
+                return owner._find_short(short_name);
+            }
+
+            const flag * find_prefix(string_view prefix, string& candidates) const
+            {
+                return owner._find_prefix(prefix, candidates);
+            }
+
+            string suggest(string_view long_name) const
+            {
+                return owner._suggest_long(long_name);
+            }
+
+            const char * process(const flag * flag, const char * value)
+            {
+                if (value && !owner.lazy) {
+                    if (const char * error = flag->check(value)) {
+                        return error;
+                    }
+                }
+
+                out._entries[flag->index].set(value);
+                return nullptr;
+            }
+
+            bool has_command(string_view) const
+            {
+                return false;
+            }
+
+            bool command(int, const char * const *, bool&)
+            {
+                return false;
+            }
+
+            void positional(const char * arg)
+            {
+                out.args.push_back(arg);
+            }
+
+            void error(string message)
+            {
+                out.error = std::move(message);
+            }
+        };
+
+        handler parse_handler{ *this, result };
+        return _scan(argc, argv, parse_handler);
+    }
+
+    ///
+    /// Parse a buffer of NUL separated arguments, such as the contents of /proc/PID/cmdline
+    /// The first argument is the program name, and a trailing NUL is optional
+    /// The result points into cmdline, which must outlive it
+    ///
+    result parse_cmdline(string_view cmdline) const
+    {
+        result result;
+        parse_cmdline(cmdline, result);
+        return result;
+    }
+
+    bool parse_cmdline(string_view cmdline, result& result) const
+    {
+        result._cmdline_argv.clear();
+        result._cmdline_argv.reserve(std::count(cmdline.begin(), cmdline.end(), '\0') + 1);
+        result._cmdline_tail.reset();
+
+        size_t offset = 0;
+        while (offset < cmdline.size()) {
+            size_t end = cmdline.find('\0', offset);
+            if (end == string_view::npos) {
+                // The final argument is not terminated in cmdline, so it alone is copied
+                result._cmdline_tail = std::make_shared<const string>(cmdline.substr(offset));
+                result._cmdline_argv.push_back(result._cmdline_tail->c_str());
+                break;
+            }
+
+            result._cmdline_argv.push_back(cmdline.data() + offset);
+            offset = end + 1;
+        }
+
+        if (result._cmdline_argv.empty()) {
+            result._cmdline_argv.push_back("");
+        }
+
+        return parse(static_cast<int>(result._cmdline_argv.size()), result._cmdline_argv.data(), result);
+    }
+
+    ///
+    /// Parse many command lines, each a buffer of NUL separated arguments as for parse_cmdline()
+    /// The work is split across `threads` worker threads, or one per hardware thread if it is 0,
+    /// and the results are returned in the same order as the command lines
+    ///
+    vector<result> parse_many(const string_view * cmdlines, size_t count, unsigned threads = 0) const
+    {
+        // Command lines are claimed in batches, so the workers rarely touch the shared counter
+        constexpr size_t batch_size = 64;
+
+        vector<result> results(count);
+
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        threads = static_cast<unsigned>(std::min<size_t>(threads, (count + batch_size - 1) / batch_size));
+
+        std::atomic<size_t> next(0);
+        vector<std::exception_ptr> errors(std::max(1u, threads));
+
+        auto worker = [&](unsigned index) {
+            try {
+                size_t begin;
+                while ((begin = next.fetch_add(batch_size)) < count) {
+                    size_t end = std::min(begin + batch_size, count);
+                    for (size_t i = begin; i < end; ++i) {
+                        parse_cmdline(cmdlines[i], results[i]);
+                    }
+                }
+            }
+            catch (...) {
+                errors[index] = std::current_exception();
+            }
+        };
+
+        // The calling thread is one of the workers
+        vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; ++i) {
+            pool.emplace_back(worker, i);
+        }
+        worker(0);
+        for (auto& thread : pool) {
+            thread.join();
+        }
+
+        for (auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        return results;
+    }
+
+    vector<result> parse_many(const vector<string_view>& cmdlines, unsigned threads = 0) const
+    {
+        return parse_many(cmdlines.data(), cmdlines.size(), threads);
+    }
+
+    ///
+    /// Describe every flag as JSON, in the order they were added, e.g.
+    /// {"flags":[{"long_name":"threads","short_name":"t","type":"int","description":"number of threads"}]}
+    /// List flags also have a "delimiter"
+    ///
+    string format_schema() const
+    {
+        string text;
+        _render_schema(text, [](const flag&, string&) { });
+        return text;
+    }
+
+protected:
+
+    template <class Options, class... Fields>
+    friend class static_schema;
+
+    static void _append_json(string& out, string_view str)
+    {
+        out += '"';
+        for (char c : str) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            }
+            else if (c == '\n') {
+                out += "\\n";
+            }
+            else if (c == '\t') {
+                out += "\\t";
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                char escape[7];
+                snprintf(escape, sizeof(escape), "\\u%04x", static_cast<unsigned>(c));
+                out += escape;
+            }
+            else {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+
+    static const char * _type_name(enum flag::type type)
+    {
+        switch (type) {
+        case flag::type::String:
+        case flag::type::CString:
+        case flag::type::StringCallback:
+        case flag::type::CStringCallback:
+            return "string";
+        case flag::type::Bool:
+        case flag::type::BoolCallback:
+            return "bool";
+        case flag::type::Int:
+        case flag::type::IntCallback:
+            return "int";
+        case flag::type::Float:
+        case flag::type::FloatCallback:
+            return "float";
+        case flag::type::StringViewList:
+            return "string_list";
+        case flag::type::IntList:
+            return "int_list";
+        case flag::type::FloatList:
+            return "float_list";
+        default:
+            return "undefined";
+        }
+    }
+
+    // extra(flag, out) can append more fields to each flag's object
+    template <class Extra>
+    void _render_schema(string& out, Extra extra) const
+    {
+        out.clear();
+        out += "{\"flags\":[";
+        for (auto& flag : _flags) {
+            out += (flag.index == 0 ? "{" : ",{");
+            out += "\"long_name\":";
+            if (flag.long_name.empty()) {
+                out += "null";
+            }
+            else {
+                _append_json(out, flag.long_name);
+            }
+            out += ",\"short_name\":";
+            if (flag.short_name == '\0') {
+                out += "null";
+            }
+            else {
+                _append_json(out, string_view(&flag.short_name, 1));
+            }
+            out += ",\"type\":\"";
+            out += _type_name(flag.type);
+            out += "\",\"description\":";
+            _append_json(out, flag.description);
+
+            if (flag.type == flag::type::StringViewList || flag.type == flag::type::IntList || flag.type == flag::type::FloatList) {
+                out += ",\"delimiter\":";
+                _append_json(out, string_view(&flag.delimiter, 1));
+            }
+            extra(flag, out);
+            out += '}';
+        }
+        out += "]}";
+    }
+
+    // The argument scanner shared by schema::parse(), cflags::parse(), and static_schema::parse()
+    // The handler looks up each flag, processes its value, collects positional arguments, dispatches subcommands,
+    // and reports errors
+    template <class Handler>
+    static bool _scan(int argc, const char * const * argv, Handler& handler)
+    {
+        const char * program = argv[0];
+
+        bool passthrough = false;
+        bool first_positional = true;
+        for (int i = 1; i < argc; ++i) {
+            const char * pch = argv[i];
+            if (!passthrough && *pch == '-') {
+                ++pch;
+                if (*pch == '-') {
+                    ++pch;
+
+                    if (*pch == '\0') {
+                        // All following flags are not to be processed
+                        passthrough = true;
+                        continue;
+                    }
+
+                    // Long
+                    // The key is not terminated in argv, so it is only ever used as a view
+                    // The value is the rest of the argument, so it is already terminated
+                    string_view key = pch;
+                    const char * value = nullptr;
+
+                    const char * divider = strchr(pch, '=');
+                    if (divider) {
+                        key = string_view(pch, divider - pch);
+                        value = divider + 1;
+                    }
+
+                    bool next_arg_is_value = (i + 1 < argc && argv[i + 1][0] != '-'
+                        && !(first_positional && handler.has_command(argv[i + 1])));
+
+                    auto flag = handler.find_long(key);
+                    if (!flag) {
+                        string candidates;
+                        flag = handler.find_prefix(key, candidates);
+                        if (!candidates.empty()) {
+                            handler.error(_format("%s: option '--%.*s' is ambiguous; possibilities:%s",
+                                program, static_cast<int>(key.size()), key.data(), candidates.c_str()));
+                            return false;
+                        }
+                    }
+
+                    if (!flag) {
+                        handler.error(_format("%s: unrecognized option '--%.*s'%s",
+                            program, static_cast<int>(key.size()), key.data(), handler.suggest(key).c_str()));
+                        return false;
+                    }
+
+                    if (!value && next_arg_is_value) {
+                        value = argv[i + 1];
+                        ++i;
+                    }
+
+                    if (value) {
+                        if (const char * error = handler.process(flag, value)) {
+                            handler.error(_format("%s: invalid value '%s' for option '--%.*s': %s",
+                                program, value, static_cast<int>(key.size()), key.data(), error));
+                            return false;
+                        }
+                    }
+                    else if (flag->type == flag::type::Bool || flag->type == flag::type::BoolCallback) {
+                        handler.process(flag, nullptr);
+                    }
+                    else {
+                        handler.error(_format("%s: option '--%.*s' requires an value", program, static_cast<int>(key.size()), key.data()));
+                        return false;
+                    }
+                }
+                else {
+                    // Short
+                    while (*pch) {
+                        bool is_last_short_flag = (*(pch + 1) == '\0');
+                        bool next_arg_is_value = (i + 1 < argc && argv[i + 1][0] != '-'
+                            && !(first_positional && handler.has_command(argv[i + 1])));
+
+                        auto flag = handler.find_short(*pch);
+                        if (!flag) {
+                            handler.error(_format("%s: unrecognized option '-%c'", program, *pch));
+                            return false;
+                        }
+
+                        if (is_last_short_flag && next_arg_is_value) {
+                            if (const char * error = handler.process(flag, argv[i + 1])) {
+                                handler.error(_format("%s: invalid value '%s' for option '-%c': %s", program, argv[i + 1], *pch, error));
+                                return false;
+                            }
+                            ++i;
+                        }
+                        else if (flag->type == flag::type::Bool || flag->type == flag::type::BoolCallback) {
+                            handler.process(flag, nullptr);
+                        }
+                        else {
+                            handler.error(_format("%s: option '-%c' requires an value", program, *pch));
+                            return false;
+                        }
+
+                        ++pch;
+                    }
+                }
+            }
+            else {
+                // The first positional argument may name a subcommand, which parses the rest of argv itself
+                // Until then a subcommand's name is never taken as a flag's value
+                bool parsed = true;
+                if (!passthrough && first_positional && handler.command(argc - i, argv + i, parsed)) {
+                    return parsed;
+                }
+                first_positional = false;
+
+                handler.positional(pch);
+            }
+        }
+
+        return true;
+    }
+
+    // Myers' bit-parallel edit distance, in Hyyrö's formulation, between a pattern of up to 64 characters
+    // and a text, where peq holds a bit for each position of each character in the pattern
+    // Each character of the text costs a handful of word operations, rather than a row of the full matrix
+    // Returns max_distance + 1 once the distance can no longer come within max_distance
+    static size_t _edit_distance(const array<uint64_t, 256>& peq, size_t pattern_size, string_view text, size_t max_distance)
+    {
+        uint64_t last = uint64_t(1) << (pattern_size - 1);
+        uint64_t pv = ~uint64_t(0);
+        uint64_t mv = 0;
+        size_t distance = pattern_size;
+
+        for (size_t i = 0; i < text.size(); ++i) {
+            uint64_t eq = peq[static_cast<unsigned char>(text[i])];
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+
+            if (ph & last) {
+                ++distance;
+            }
+            else if (mh & last) {
+                --distance;
+            }
+
+            // The distance falls by at most one for each remaining character
+            if (distance > max_distance + (text.size() - i - 1)) {
+                return max_distance + 1;
+            }
+
+            // The first row counts insertions, so it grows by one for every character of the text
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+        }
+
+        return (distance > max_distance ? max_distance + 1 : distance);
+    }
+
+    // The suggestion index is built by freeze(), so an unfrozen schema compares every flag instead
+    string _suggest_long(string_view name, string_view dashes = "--") const
+    {
+        return (_frozen ? _suggestions.suggest(name, dashes) : _suggest(name, _flags, dashes));
+    }
+
+    // Finish an "unrecognized option" message with the closest long names in flags, if any are close enough
+    // This compares every flag, for flags without a suggestion index
+    template <class Flags>
+    static string _suggest(string_view name, const Flags& flags, string_view dashes = "--")
+    {
+        // Only the first 64 characters fit in a word, which is more than any real flag name
+        string_view pattern = name.substr(0, 64);
+        size_t max_distance = std::clamp<size_t>(pattern.size() / 3, 1, 3);
+        if (pattern.size() < 2) {
+            return string();
+        }
+
+        array<uint64_t, 256> peq = {};
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            peq[static_cast<unsigned char>(pattern[i])] |= uint64_t(1) << i;
+        }
+
+        array<string_view, 3> suggestions;
+        size_t suggestion_count = 0;
+        size_t best = max_distance + 1;
+
+        for (auto& candidate : flags) {
+            string_view long_name = candidate.long_name;
+            size_t size_difference = (long_name.size() > pattern.size() ? long_name.size() - pattern.size() : pattern.size() - long_name.size());
+            if (long_name.empty() || size_difference > best) {
+                continue;
+            }
+
+            size_t distance = _edit_distance(peq, pattern.size(), long_name, best);
+            if (distance > max_distance || distance > best || distance >= pattern.size()) {
+                continue;
+            }
+            if (distance < best) {
+                best = distance;
+                suggestion_count = 0;
+            }
+
+            // The first flag registered with a name wins, so later duplicates are skipped
+            auto end = suggestions.begin() + suggestion_count;
+            if (suggestion_count < suggestions.size() && std::find(suggestions.begin(), end, long_name) == end) {
+                suggestions[suggestion_count++] = long_name;
+            }
+        }
+
+        string message;
+        for (size_t i = 0; i < suggestion_count; ++i) {
+            message += (i == 0 ? "; did you mean '" : ", '");
+            message += dashes;
+            message += suggestions[i];
+            message += '\'';
+        }
+        if (suggestion_count > 0) {
+            message += '?';
+        }
+        return message;
+    }
+
+    // Error messages are only formatted once parsing has already failed
+    static string _format(const char * format, ...)
+    {
+        va_list args;
+        va_start(args, format);
+        va_list copy;
+        va_copy(copy, args);
+        int size = vsnprintf(nullptr, 0, format, copy);
+        va_end(copy);
+
+        string message(size > 0 ? size : 0, '\0');
+        vsnprintf(&message[0], message.size() + 1, format, args);
+        va_end(args);
+        return message;
+    }
+
+    // The flags are owned by the schema, so the stored pointers are never to const
+    flag * _find_long(string_view long_name) const
+    {
+        if (!_frozen) {
+            for (auto& candidate : _flags) {
+                if (candidate.long_name == long_name) {
+                    return const_cast<flag *>(&candidate);
+                }
+            }
+            return nullptr;
+        }
+
+        auto it = _long_index.find(long_name);
+        return (it == _long_index.end() ? nullptr : it->second);
+    }
+
+    // Binary search the sorted long names for those starting with prefix
+    // Returns the only match, or nullptr with candidates listing every match when there are several
+    flag * _find_prefix(string_view prefix, string& candidates) const
+    {
+        if (!prefix_matching) {
+            return nullptr;
+        }
+
+        auto starts_with = [prefix](const flag * candidate) {
+            return candidate->long_name.compare(0, prefix.size(), prefix) == 0;
+        };
+
+        auto first = _prefix_lower_bound(prefix);
+        if (first == _prefix_index.end() || !starts_with(*first)) {
+            return nullptr;
+        }
+
+        auto next = first + 1;
+        if (next == _prefix_index.end() || !starts_with(*next)) {
+            return *first;
+        }
+
+        for (auto it = first; it != _prefix_index.end() && starts_with(*it); ++it) {
+            candidates += " '--";
+            candidates += (*it)->long_name;
+            candidates += '\'';
+        }
+        return nullptr;
+    }
+
+    // The first sorted long name starting with prefix, if there is one
+    vector<flag *>::const_iterator _prefix_lower_bound(string_view prefix) const
+    {
+        return std::lower_bound(_prefix_index.begin(), _prefix_index.end(), prefix,
+            [](const flag * candidate, string_view value) { return candidate->long_name < value; });
+    }
+
+    static bool _compare_long_names(const flag * lhs, const flag * rhs)
+    {
+        return lhs->long_name < rhs->long_name;
+    }
+
+    flag * _find_short(char short_name) const
+    {
+        if (!_frozen) {
+            for (auto& candidate : _flags) {
+                if (short_name != '\0' && candidate.short_name == short_name) {
+                    return const_cast<flag *>(&candidate);
+                }
+            }
+            return nullptr;
+        }
+
+        return _short_index[static_cast<unsigned char>(short_name)];
+    }
+
+    // The first flag registered with a given name wins, matching the order of
+    // the previous linear search
+    void _index_flag(flag& flag)
+    {
+        if (!flag.long_name.empty()) {
+            _long_index.emplace(flag.long_name, &flag);
+        }
+
+        auto short_index = static_cast<unsigned char>(flag.short_name);
+        if (short_index != '\0' && !_short_index[short_index]) {
+            _short_index[short_index] = &flag;
+        }
+    }
+
+    // A deque never moves its elements when growing, so flag pointers stay valid
+    deque<flag> _flags;
+
+    bool _frozen = false;
+
+    // Incremented by every add_flag(), so anything rendered from the flags knows when it is stale
+    size_t _revision = 0;
+
+    // Keys point into the long_name of each flag in _flags
+    unordered_map<string_view, flag *> _long_index;
+
+    array<flag *, 256> _short_index = {};
+
+    // Flags sorted by long name, only built when prefix_matching or _sort_names is set
+    vector<flag *> _prefix_index;
+
+    // The long names that win their name, built by freeze() for suggestions
+    suggestion_index _suggestions;
+
+    // Set by cflags::freeze() when completion needs the sorted names without prefix matching
+    bool _sort_names = false;
+
+};
+
+inline const result::entry * result::_find(const flag * flag) const
+{
+    if (!flag || flag->index >= _entries.size()) {
+        return nullptr;
+    }
+    return &_entries[flag->index];
+}
+
+inline unsigned result::count(const flag * flag) const
+{
+    auto found = _find(flag);
+    return (found ? found->count : 0);
+}
+
+inline unsigned result::count(string_view long_name) const
+{
+    return count(_schema ? _schema->find_long(long_name) : nullptr);
+}
+
+inline const char * result::value(const flag * flag) const
+{
+    auto found = _find(flag);
+    return (found ? found->value : nullptr);
+}
+
+inline const char * result::value(string_view long_name) const
+{
+    return value(_schema ? _schema->find_long(long_name) : nullptr);
+}
+
+template <class T>
+const char * result::try_get(const flag * flag, T& out) const
+{
+    auto found = _find(flag);
+    if (!found || found->count == 0) {
+        return nullptr;
+    }
+
+    if constexpr (std::is_same_v<T, bool>) {
+        out = (found->value ? flag::parse_bool(found->value) : true);
+        return nullptr;
+    }
+    else {
+        if (!found->value) {
+            return nullptr;
+        }
+
+        if constexpr (std::is_same_v<T, const char *> || std::is_same_v<T, string_view> || std::is_same_v<T, string>) {
+            out = T(found->value);
+        }
+        else if constexpr (std::is_same_v<T, int>) {
+            if (found->cached != cache::int_value) {
+                int converted;
+                if (const char * reason = from_string(found->value, converted)) {
+                    return reason;
+                }
+                found->cached_int = converted;
+                found->cached = cache::int_value;
+            }
+            out = found->cached_int;
+        }
+        else if constexpr (std::is_same_v<T, float>) {
+            if (found->cached != cache::float_value) {
+                float converted;
+                if (const char * reason = from_string(found->value, converted)) {
+                    return reason;
+                }
+                found->cached_float = converted;
+                found->cached = cache::float_value;
+            }
+            out = found->cached_float;
+        }
+        else {
+            T list;
+            if (const char * reason = flag->process_list(found->value, list)) {
+                return reason;
+            }
+            out = std::move(list);
+        }
+        return nullptr;
+    }
+}
+
+template <class T>
+const char * result::try_get(string_view long_name, T& out) const
+{
+    return try_get(_schema ? _schema->find_long(long_name) : nullptr, out);
+}
+
+template <class T>
+T result::get(const flag * flag, T fallback) const
+{
+    try_get(flag, fallback);
+    return fallback;
+}
+
+template <class T>
+T result::get(string_view long_name, T fallback) const
+{
+    return get<T>(_schema ? _schema->find_long(long_name) : nullptr, std::move(fallback));
+}
+
+class cflags : public schema
+{
+public:
+
+    static constexpr int max_response_file_depth = 32;
+
+    string program;
+    vector<string_view> args;
+
+    int argc;
+    const char * const * argv;
+
+    // Replace @file arguments with the arguments read from the file
+    bool expand_response_files = false;
+
+    // Answer the hidden --__complete and --__complete-script arguments used by shell completion
+    // Set this before freeze(), as completion uses the same index as prefix_matching
+    bool completion = false;
+
+    // Set when parse() answered a completion request instead, and returned false without parsing anything
+    bool completed = false;
+
+#if defined(CFLAGS_STATS)
+    parse_stats stats;
+
+    void reset_stats()
+    {
+        stats = parse_stats();
+        for (auto& flag : _flags) {
+            flag.stats = flag_stats();
+        }
+    }
+#endif
+
+    cflags()
+        : argc(0)
+        , argv(nullptr)
+    { }
+
+    // The flag index and argv point into this object's own storage
+    cflags(const cflags&) = delete;
+    cflags& operator=(const cflags&) = delete;
+
+    cflags(cflags&&) = default;
+    cflags& operator=(cflags&&) = default;
+
+    ///
+    /// Read a flag's value from an environment variable, which is applied before any arguments
+    ///
+    void bind_env(flag * flag, string env_name)
+    {
+        _env_bindings[flag] = std::move(env_name);
+        _reset_env_index();
+        ++_revision;
+    }
+
+    ///
+    /// Read every flag with a long name from an environment variable named prefix followed by the
+    /// long name in uppercase with '-' replaced by '_', e.g. "APP_" and "log-level" become APP_LOG_LEVEL
+    /// Flags bound with bind_env() use that name instead
+    ///
+    void set_env_prefix(string prefix)
+    {
+        _env_prefix = std::move(prefix);
+        _reset_env_index();
+        ++_revision;
+    }
+
+    ///
+    /// Add the flags in [first, last), such as a table of flags defined with CPPFLAGS_DEFINE_*()
+    ///
+    void add_definitions(const flag_definition * first, const flag_definition * last)
+    {
+        for (auto definition = first; definition != last; ++definition) {
+            switch (definition->type) {
+            case flag::type::CString:
+                add_cstring(definition->short_name, definition->long_name, static_cast<const char **>(definition->value), definition->description);
+                break;
+            case flag::type::Bool:
+                add_bool(definition->short_name, definition->long_name, static_cast<bool *>(definition->value), definition->description);
+                break;
+            case flag::type::Int:
+                add_int(definition->short_name, definition->long_name, static_cast<int *>(definition->value), definition->description);
+                break;
+            case flag::type::Float:
+                add_float(definition->short_name, definition->long_name, static_cast<float *>(definition->value), definition->description);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+#if defined(CFLAGS_HAVE_SECTIONS)
+    ///
+    /// Add every flag defined with CPPFLAGS_DEFINE_*() in the program
+    ///
+    void add_static_flags()
+    {
+        add_definitions(__start_cflags_cpp_flags, __stop_cflags_cpp_flags);
+    }
+#endif
+
+    ///
+    /// Add a subcommand with its own flags, selected when name is the first positional argument
+    /// setup adds the subcommand's flags, and is only run the first time the subcommand is selected
+    /// The subcommand parses the rest of the arguments, including any nested subcommands, in the same pass
+    ///
+    void add_command(string name, function<void(cflags&)> setup, string description)
+    {
+        _commands.push_back({ std::move(name), std::move(description), std::move(setup), nullptr });
+        ++_revision;
+    }
+
+    ///
+    /// The subcommand selected by the last parse(), or nullptr
+    /// Its args, argc, and argv hold the positional arguments after the subcommand's name
+    ///
+    cflags * command() const
+    {
+        return _command;
+    }
+
+    ///
+    /// The candidates a completion request prints for the last of words, one per line
+    /// The words before it are those already typed after the program's name, and a subcommand they name completes the rest
+    /// Long names are offered for a word starting with '-', and subcommand names for the first positional argument
+    ///
+    string complete(int word_count, const char * const * words)
+    {
+        if (!_frozen) {
+            freeze();
+        }
+
+        // The words are walked as parse() would, without applying anything, to find which parser the last one is for
+        bool first_positional = true;
+        for (int i = 0; i + 1 < word_count; ++i) {
+            const char * arg = words[i];
+            if (strcmp(arg, "--") == 0) {
+                return string();
+            }
+
+            if (arg[0] == '-') {
+                // A flag takes the next word as its value, unless it has one already or the next word names a subcommand
+                bool has_value = (arg[1] == '-' && strchr(arg, '='));
+                if (!has_value && i + 2 < word_count && words[i + 1][0] != '-' && !(first_positional && _find_command(words[i + 1]))) {
+                    ++i;
+                }
+                continue;
+            }
+
+            if (first_positional) {
+                if (cflags * command = _command_parser(arg)) {
+                    return command->complete(word_count - i - 1, words + i + 1);
+                }
+            }
+            first_positional = false;
+        }
+
+        return _complete(word_count > 0 ? words[word_count - 1] : "", first_positional);
+    }
+
+    ///
+    /// Build the long name, short name, and environment variable lookup tables used by parse()
+    /// This is called automatically by parse(), and flags added afterwards are indexed as they are added
+    ///
+    void freeze()
+    {
+        _sort_names = completion;
+        schema::freeze();
+        CFLAGS_STAT(stats.estimated_allocations += _long_index.size());
+
+        _reset_env_index();
+        _index_env();
+    }
+
+    // The const lookups from schema never freeze, and are not counted in stats
+    using schema::find_long;
+    using schema::find_short;
+
+    flag * find_long(string_view long_name)
+    {
+        if (!_frozen) {
+            freeze();
+        }
+
+        CFLAGS_STAT(++stats.probes);
+        CFLAGS_STAT(stats.comparisons += _long_index.bucket_size(_long_index.bucket(long_name)));
+
+        flag * flag = _find_long(long_name);
+        CFLAGS_STAT(if (flag) { ++flag->stats.lookups; });
+        return flag;
+    }
+
+    flag * find_short(char short_name)
+    {
+        if (!_frozen) {
+            freeze();
+        }
+
+        flag * flag = _find_short(short_name);
+        CFLAGS_STAT(++stats.probes);
+        CFLAGS_STAT(if (flag) { ++flag->stats.lookups; });
+        return flag;
+    }
+
+    ///
+    /// The arguments are never written to, so the same argv can be parsed again or shared between threads
+    /// With completion set, a completion request is answered on stdout instead, and this returns false with completed set
+    ///
+    inline bool parse(int main_argc, const char * const * main_argv)
+    {
+#if defined(CFLAGS_STATS)
+        using clock = std::chrono::steady_clock;
+
+        auto start = clock::now();
+        auto callback_start = stats.callback_ns;
+
+        bool result = _parse(main_argc, main_argv);
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+        stats.library_ns += static_cast<unsigned long long>(elapsed) - (stats.callback_ns - callback_start);
+        return result;
+#else
+        return _parse(main_argc, main_argv);
+#endif
+    }
+
+private:
+
+    // Answer a completion request from the flag index alone, without applying any flag or calling any callback
+    // Returns true if argv was a completion request, and sets completed if it was answered
+    bool _handle_completion()
+    {
+        string_view request = argv[1];
+        if (request == "--__complete") {
+            _write_stdout(complete(argc - 2, argv + 2));
+            completed = true;
+            return true;
+        }
+        if (request == "--__complete-script") {
+            const char * shell = (argc > 2 ? argv[2] : "bash");
+            const char * script = _completion_script(shell);
+            if (!script) {
+                fprintf(stderr, "%s: unsupported shell '%s', expected bash, zsh, or fish\n", program.c_str(), shell);
+                return true;
+            }
+            _write_stdout(_format_completion_script(script));
+            completed = true;
+            return true;
+        }
+        return false;
+    }
+
+    // Every long name starting with word, or with commands set every subcommand name starting with it
+    // Other words get no candidates, so the shell falls back to completing files
+    string _complete(string_view word, bool commands) const
+    {
+        string candidates;
+        if (word.empty() || word[0] != '-') {
+            for (auto& command : _commands) {
+                if (commands && command.name.compare(0, word.size(), word) == 0) {
+                    candidates += command.name;
+                    candidates += '\n';
+                }
+            }
+            return candidates;
+        }
+        string_view name = word.substr(word.size() > 1 && word[1] == '-' ? 2 : 1);
+
+        for (auto it = _prefix_lower_bound(name); it != _prefix_index.end(); ++it) {
+            if ((*it)->long_name.compare(0, name.size(), name) != 0) {
+                break;
+            }
+            candidates += "--";
+            candidates += (*it)->long_name;
+            candidates += '\n';
+        }
+        return candidates;
+    }
+
+    // Each script calls the program with --__complete, the words before the cursor, and the word under it
+    // @NAME@ is replaced with the program's name, and @FUNC@ with the same name made safe for a shell function
+    static const char * _completion_script(string_view shell)
+    {
+        if (shell == "bash") {
+            return
+                "_@FUNC@_complete() {\n"
+                "    local cur=\"${COMP_WORDS[COMP_CWORD]}\"\n"
+                "    COMPREPLY=($(compgen -W \"$(\"${COMP_WORDS[0]}\" --__complete \"${COMP_WORDS[@]:1:COMP_CWORD}\" 2>/dev/null)\" -- \"$cur\"))\n"
+                "}\n"
+                "complete -o default -F _@FUNC@_complete @NAME@\n";
+        }
+        if (shell == "zsh") {
+            return
+                "#compdef @NAME@\n"
+                "_@FUNC@_complete() {\n"
+                "    local -a candidates\n"
+                "    candidates=(${(f)\"$(\"${words[1]}\" --__complete \"${(@)words[2,CURRENT]}\" 2>/dev/null)\"})\n"
+                "    if (( ${#candidates} )); then\n"
+                "        compadd -- $candidates\n"
+                "    else\n"
+                "        _files\n"
+                "    fi\n"
+                "}\n"
+                "compdef _@FUNC@_complete @NAME@\n";
+        }
+        if (shell == "fish") {
+            return "complete -c @NAME@ -a '(@NAME@ --__complete (commandline -opc | tail -n +2) (commandline -ct) 2>/dev/null)'\n";
+        }
+        return nullptr;
+    }
+
+    string _format_completion_script(string_view script) const
+    {
+        string_view name = program;
+        size_t slash = name.rfind('/');
+        if (slash != string_view::npos) {
+            name.remove_prefix(slash + 1);
+        }
+
+        string function(name);
+        for (char& c : function) {
+            c = (isalnum(static_cast<unsigned char>(c)) ? c : '_');
+        }
+
+        string text;
+        for (size_t i = 0; i < script.size(); ++i) {
+            if (script.compare(i, 6, "@NAME@") == 0) {
+                text += name;
+                i += 5;
+            }
+            else if (script.compare(i, 6, "@FUNC@") == 0) {
+                text += function;
+                i += 5;
+            }
+            else {
+                text += script[i];
+            }
+        }
+        return text;
+    }
+
+    inline bool _parse(int main_argc, const char * const * main_argv)
+    {
+        if (!_frozen) {
+            freeze();
+        }
+
+        args.clear();
+        _argv.clear();
+        _command = nullptr;
+
+        argc = main_argc;
+        argv = main_argv;
+
+        program = argv[0];
+
+        completed = false;
+        if (completion && argc > 1 && _handle_completion()) {
+            return false;
+        }
+
+        if (expand_response_files && !_expand_response_files()) {
+            return false;
+        }
+
+        // Environment variables are applied first, so arguments take precedence
+        _index_env();
+        if (!_apply_env()) {
+            return false;
+        }
+
+        struct handler
+        {
+            class cflags& owner;
+
+            flag * find_long(string_view long_name)
+            {
+                return owner.find_long(long_name);
+            }
+
+            flag * find_short(char short_name)
+            {
+                return owner.find_short(short_name);
+            }
+
+            flag * find_prefix(string_view prefix, string& candidates)
+            {
+                return owner._find_prefix(prefix, candidates);
+            }
+
+            string suggest(string_view long_name) const
+            {
+                return owner._suggest_long(long_name);
+            }
+
+            const char * process(flag * flag, const char * value)
+            {
+                return owner._process(flag, value);
+            }
+
+            bool has_command(string_view name) const
+            {
+                return owner._find_command(name) != nullptr;
+            }
+
+            bool command(int command_argc, const char * const * command_argv, bool& parsed)
+            {
+                cflags * command = owner._select_command(command_argv[0]);
+                if (!command) {
+                    return false;
+                }
+                parsed = command->parse(command_argc, command_argv);
+                owner.completed = command->completed;
+                return true;
+            }
+
+            void positional(const char * arg)
+            {
+                CFLAGS_STAT(if (owner.args.size() == owner.args.capacity()) { ++owner.stats.estimated_allocations; });
+                CFLAGS_STAT(if (owner._argv.size() == owner._argv.capacity()) { ++owner.stats.estimated_allocations; });
+                owner.args.push_back(arg);
+                owner._argv.push_back(arg);
+            }
+
+            void error(const string& message)
+            {
+                fprintf(stderr, "%s\n", message.c_str());
+            }
+        };
+
+        handler parse_handler{ *this };
+        if (!_scan(argc, argv, parse_handler)) {
+            return false;
+        }
+
+        argc = static_cast<int>(_argv.size());
+        argv = _argv.data();
+
+        return true;
+    }
+
+public:
+
+    ///
+    /// Parse a buffer of NUL separated arguments, such as the contents of /proc/PID/cmdline
+    /// The first argument is the program name, and a trailing NUL is optional
+    /// args and any [c]string values point into cmdline, which must outlive their use
+    ///
+    inline bool parse_cmdline(string_view cmdline)
+    {
+        _cmdline_argv.clear();
+        _cmdline_tail.reset();
+
+        size_t offset = 0;
+        while (offset < cmdline.size()) {
+            size_t end = cmdline.find('\0', offset);
+            if (end == string_view::npos) {
+                // The final argument is not terminated in cmdline, so it alone is copied
+                _cmdline_tail = std::make_shared<const string>(cmdline.substr(offset));
+                _cmdline_argv.push_back(_cmdline_tail->c_str());
+                break;
+            }
+
+            _cmdline_argv.push_back(cmdline.data() + offset);
+            offset = end + 1;
+        }
+
+        if (_cmdline_argv.empty()) {
+            _cmdline_argv.push_back("");
+        }
+
+        return parse(static_cast<int>(_cmdline_argv.size()), _cmdline_argv.data());
+    }
+
+    ///
+    /// Load flag values from a file of `key = value` lines, as if they had been passed as `--key=value`
+    /// Lines may also be written as `--key=value`, `key value`, or just `key` for bool flags
+    /// Blank lines and lines starting with '#' or ';' are ignored, and values may be wrapped in quotes
+    /// Keys following a `[section]` line are looked up as `section.key`
+    /// Call this before parse(), so that environment variables and arguments take precedence
+    ///
+    bool load_config(const string& path)
+    {
+        if (!_frozen) {
+            freeze();
+        }
+
+        // Values are terminated in place, and cstring values point into the file, so it is kept
+        loaded_file * loaded = _load_file(path.c_str(), true);
+        if (!loaded) {
+            fprintf(stderr, "cflags: unable to read config file '%s'\n", path.c_str());
+            return false;
+        }
+
+        if (loaded->complete) {
+            // The file is unchanged since it was loaded, and its values were all accepted then
+            for (auto& value : loaded->values) {
+                _process(value.first, value.second);
+            }
+            return true;
+        }
+
+        mapped_file& current = *loaded->file;
+
+        auto trim = [](char *& begin, char *& end) {
+            while (begin < end && isspace(static_cast<unsigned char>(*begin))) {
+                ++begin;
+            }
+            while (end > begin && isspace(static_cast<unsigned char>(*(end - 1)))) {
+                --end;
+            }
+        };
+
+        size_t section_len = 0;
+        _config_key.clear();
+
+        char * cursor = current.data();
+        char * data_end = current.data() + current.size();
+        size_t line_number = 0;
+        while (cursor < data_end) {
+            ++line_number;
+
+            char * line = cursor;
+            char * line_end = static_cast<char *>(memchr(cursor, '\n', data_end - cursor));
+            if (!line_end) {
+                line_end = data_end;
+            }
+            cursor = (line_end < data_end ? line_end + 1 : data_end);
+
+            trim(line, line_end);
+            if (line == line_end || *line == '#' || *line == ';') {
+                continue;
+            }
+
+            if (*line == '[') {
+                char * section = line + 1;
+                char * section_end = static_cast<char *>(memchr(section, ']', line_end - section));
+                if (!section_end) {
+                    fprintf(stderr, "%s:%zu: expected ']'\n", path.c_str(), line_number);
+                    return false;
+                }
+                trim(section, section_end);
+
+                _config_key.assign(section, section_end);
+                if (!_config_key.empty()) {
+                    _config_key += '.';
+                }
+                section_len = _config_key.size();
+                continue;
+            }
+
+            if (line_end - line > 2 && line[0] == '-' && line[1] == '-') {
+                line += 2;
+            }
+
+            char * key_end = line;
+            while (key_end < line_end && *key_end != '=' && !isspace(static_cast<unsigned char>(*key_end))) {
+                ++key_end;
+            }
+
+            char * value = key_end;
+            char * value_end = line_end;
+            trim(value, value_end);
+            if (value < value_end && *value == '=') {
+                ++value;
+                trim(value, value_end);
+            }
+
+            if (value_end - value >= 2 && (*value == '"' || *value == '\'') && *(value_end - 1) == *value) {
+                ++value;
+                --value_end;
+            }
+
+            string_view key(line, key_end - line);
+            if (section_len > 0) {
+                _config_key.resize(section_len);
+                _config_key.append(key);
+                key = _config_key;
+            }
+
+            flag * flag = find_long(key);
+            if (!flag) {
+                string suggestions = _suggest_long(key, "");
+                fprintf(stderr, "%s:%zu: unrecognized option '%.*s'%s\n", path.c_str(), line_number, static_cast<int>(key.size()), key.data(), suggestions.c_str());
+                return false;
+            }
+
+            // Terminate the value in place, over the newline or the spare byte past the end of the data
+            bool has_value = (value < value_end || (key_end < line_end && *key_end == '='));
+            *value_end = '\0';
+
+            if (has_value) {
+                if (const char * error = _process(flag, value)) {
+                    fprintf(stderr, "%s:%zu: invalid value '%s' for option '%.*s': %s\n",
+                        path.c_str(), line_number, value, static_cast<int>(key.size()), key.data(), error);
+                    return false;
+                }
+                loaded->values.emplace_back(flag, value);
+            }
+            else if (flag->type == flag::type::Bool || flag->type == flag::type::BoolCallback) {
+                _process(flag, nullptr);
+                loaded->values.emplace_back(flag, nullptr);
+            }
+            else {
+                fprintf(stderr, "%s:%zu: option '%.*s' requires an value\n", path.c_str(), line_number, static_cast<int>(key.size()), key.data());
+                return false;
+            }
+        }
+
+        loaded->complete = true;
+        return true;
+    }
+
+    ///
+    /// Read a flag's value recorded with `lazy` set, converting it on the first call, see result::get()
+    /// Values given with `lazy` unset are only written to the flag's target, so this returns fallback
+    ///
+    template <class T>
+    T get(string_view long_name, T fallback = T()) const
+    {
+        return _values.get<T>(schema::find_long(long_name), std::move(fallback));
+    }
+
+    template <class T>
+    const char * try_get(string_view long_name, T& out) const
+    {
+        return _values.try_get(schema::find_long(long_name), out);
+    }
+
+    ///
+    /// Render the usage text, wrapped to width columns, or to the terminal when width is 0
+    /// The flag table is only rendered again after flags are added or the width changes
+    /// The text is owned by this object, and valid until the next call
+    ///
+    const string& format_usage(const string& usage, const string& above, const string& below, size_t width = 0)
+    {
+        if (width == 0) {
+            width = _terminal_width();
+        }
+
+        if (_usage_revision != _revision || _usage_width != width) {
+            _render_usage_table(width);
+            _usage_revision = _revision;
+            _usage_width = width;
+        }
+
+        _usage_text.clear();
+        _usage_text.reserve(program.size() + usage.size() + above.size() + _usage_table.size() + below.size() + 16);
+        _usage_text += "Usage: ";
+        _usage_text += program;
+        _usage_text += ' ';
+        _usage_text += usage;
+        _usage_text += '\n';
+        _usage_text += above;
+        _usage_text += "\n\n";
+        _usage_text += _usage_table;
+        _usage_text += '\n';
+        _usage_text += below;
+        _usage_text += '\n';
+        return _usage_text;
+    }
+
+    void print_usage(const string& usage, const string& above, const string& below)
+    {
+        _write_stdout(format_usage(usage, above, below));
+    }
+
+    ///
+    /// As schema::format_schema(), with an "env" for flags bound with bind_env()
+    /// The text is kept until flags are added
+    ///
+    const string& format_schema()
+    {
+        if (_schema_revision != _revision) {
+            _render_schema(_schema_text, [this](const flag& flag, string& out) {
+                auto it = _env_bindings.find(&flag);
+                if (it != _env_bindings.end()) {
+                    out += ",\"env\":";
+                    _append_json(out, it->second);
+                }
+                else if (!_env_prefix.empty() && !flag.long_name.empty()) {
+                    out += ",\"env\":";
+                    _append_json(out, _env_name(flag));
+                }
+            });
+            _schema_revision = _revision;
+        }
+        return _schema_text;
+    }
+
+private:
+
+    static constexpr size_t _usage_name_width = 20;
+    static constexpr size_t _usage_description_column = 2 + 4 + 2 + _usage_name_width;
+
+    // The terminal width of stdout, or $COLUMNS, or 80 when output is not to a terminal
+    static size_t _terminal_width()
+    {
+#if !defined(_WIN32)
+        struct winsize size;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+            return size.ws_col;
+        }
+#endif
+
+        const char * columns = getenv("COLUMNS");
+        int width = 0;
+        if (columns && !from_string(columns, width) && width > 0) {
+            return static_cast<size_t>(width);
+        }
+        return 80;
+    }
+
+    // Descriptions are wrapped at spaces to fit width, unless that would leave them fewer than 20 columns
+    void _render_usage_table(size_t width)
+    {
+        size_t wrap = (width >= _usage_description_column + 20 ? width - _usage_description_column : string::npos);
+
+        _usage_table.clear();
         for (auto& flag : _flags) {
-            printf("  ");
+            _usage_table += "  ";
             if (flag.short_name != '\0') {
-                printf("-%c, ", flag.short_name);
+                _usage_table += '-';
+                _usage_table += flag.short_name;
+                _usage_table += ", ";
+            }
+            else {
+                _usage_table.append(4, ' ');
+            }
+
+            // Flags with only a short name have no "--" either, so they are padded by two more
+            if (!flag.long_name.empty()) {
+                _usage_table += "--";
+                _usage_table += flag.long_name;
+            }
+            if (flag.long_name.size() > _usage_name_width) {
+                _usage_table += '\n';
+                _usage_table.append(_usage_description_column, ' ');
+            }
+            else {
+                _usage_table.append(_usage_name_width - flag.long_name.size() + (flag.long_name.empty() ? 2 : 0), ' ');
+            }
+
+            _append_description(flag.description, wrap);
+        }
+
+        if (!_commands.empty()) {
+            _usage_table += "\nCommands:\n";
+        }
+        for (auto& command : _commands) {
+            _usage_table += "  ";
+            _usage_table += command.name;
+            if (command.name.size() + 4 > _usage_description_column) {
+                _usage_table += '\n';
+                _usage_table.append(_usage_description_column, ' ');
+            }
+            else {
+                _usage_table.append(_usage_description_column - 2 - command.name.size(), ' ');
+            }
+
+            _append_description(command.description, wrap);
+        }
+    }
+
+    void _append_description(string_view description, size_t wrap)
+    {
+        while (description.size() > wrap) {
+            // Break at the last space that fits, or the first one after it for a word that is too long
+            size_t line_size = description.rfind(' ', wrap);
+            if (line_size == string_view::npos || line_size == 0) {
+                line_size = description.find(' ', wrap);
+                if (line_size == string_view::npos) {
+                    break;
+                }
+            }
+
+            _usage_table += description.substr(0, line_size);
+            _usage_table += '\n';
+            _usage_table.append(_usage_description_column, ' ');
+
+            size_t next = description.find_first_not_of(' ', line_size);
+            description.remove_prefix(next == string_view::npos ? description.size() : next);
+        }
+
+        _usage_table += description;
+        _usage_table += '\n';
+    }
+
+    struct command_entry
+    {
+        string name;
+        string description;
+        function<void(cflags&)> setup;
+
+        // Created and set up when the command is first selected
+        unique_ptr<cflags> parser;
+    };
+
+    const command_entry * _find_command(string_view name) const
+    {
+        for (auto& command : _commands) {
+            if (command.name == name) {
+                return &command;
+            }
+        }
+        return nullptr;
+    }
+
+    // Find the parser for the command named name, running its setup the first time it is needed
+    cflags * _command_parser(string_view name)
+    {
+        auto command = const_cast<command_entry *>(_find_command(name));
+        if (!command) {
+            return nullptr;
+        }
+
+        if (!command->parser) {
+            command->parser.reset(new cflags());
+            command->parser->prefix_matching = prefix_matching;
+            command->parser->lazy = lazy;
+            command->parser->completion = completion;
+            command->setup(*command->parser);
+        }
+
+        return command->parser.get();
+    }
+
+    cflags * _select_command(string_view name)
+    {
+        _command = _command_parser(name);
+        return _command;
+    }
+
+    // Write all of text to stdout in as few calls as the system allows, after anything already buffered
+    static void _write_stdout(string_view text)
+    {
+        fflush(stdout);
+
+#if !defined(_WIN32)
+        while (!text.empty()) {
+            ssize_t written = write(STDOUT_FILENO, text.data(), text.size());
+            if (written <= 0) {
+                break;
+            }
+            text.remove_prefix(static_cast<size_t>(written));
+        }
+#else
+        fwrite(text.data(), 1, text.size(), stdout);
+        fflush(stdout);
+#endif
+    }
+
+    // Find the next whitespace separated token in [cursor, end), and NUL terminate it in place
+    // Quotes are removed, and backslash escapes are handled outside of quotes and inside double quotes
+    // Returns nullptr when there are no more tokens
+    static char * _next_token(char *& cursor, char * end)
+    {
+        char * read = cursor;
+        while (read < end && isspace(static_cast<unsigned char>(*read))) {
+            ++read;
+        }
+
+        if (read == end) {
+            cursor = end;
+            return nullptr;
+        }
+
+        // The unquoted token is never longer than the quoted one, so it can be written over itself
+        char * token = read;
+        char * write = read;
+        char quote = '\0';
+        while (read < end) {
+            char c = *read;
+            if (quote) {
+                if (c == quote) {
+                    quote = '\0';
+                    ++read;
+                    continue;
+                }
+                if (c == '\\' && quote == '"' && read + 1 < end) {
+                    c = *++read;
+                }
             }
             else {
-                printf("    ");
+                if (isspace(static_cast<unsigned char>(c))) {
+                    break;
+                }
+                if (c == '\'' || c == '"') {
+                    quote = c;
+                    ++read;
+                    continue;
+                }
+                if (c == '\\' && read + 1 < end) {
+                    c = *++read;
+                }
             }
 
-            if (!flag.long_name.empty()) {
-                printf("--%s", flag.long_name.c_str());
+            *write++ = c;
+            ++read;
+        }
+
+        cursor = (read < end ? read + 1 : end);
+        *write = '\0';
+        return token;
+    }
+
+    // A response or config file with what was read from it, kept as parsed values may point into it
+    struct loaded_file
+    {
+        unique_ptr<mapped_file> file;
+        bool config = false;
+
+        // Set once the whole file has been read, after which it is reused while it is unchanged
+        bool complete = false;
+
+        // The tokens of a response file, or the flags and values read from a config file
+        vector<char *> tokens;
+        vector<std::pair<flag *, const char *>> values;
+    };
+
+    // Append arg to _response_argv, recursively replacing @file arguments with the tokens in the file
+    // stack holds the files currently being expanded, to detect cycles
+    bool _expand_arg(const char * arg, vector<const mapped_file *>& stack, bool& passthrough)
+    {
+        if (passthrough || arg[0] != '@' || arg[1] == '\0') {
+            if (strcmp(arg, "--") == 0) {
+                passthrough = true;
+            }
+            CFLAGS_STAT(if (_response_argv.size() == _response_argv.capacity()) { ++stats.estimated_allocations; });
+            _response_argv.push_back(arg);
+            return true;
+        }
+
+        const char * path = arg + 1;
+
+        if (stack.size() == max_response_file_depth) {
+            fprintf(stderr, "%s: response file '%s' is nested too deeply\n", program.c_str(), path);
+            return false;
+        }
+
+        // Arguments point into the file, so it is kept until this object is destroyed
+        loaded_file * loaded = _load_file(path, false);
+        if (!loaded) {
+            fprintf(stderr, "%s: unable to read response file '%s'\n", program.c_str(), path);
+            return false;
+        }
+
+        const mapped_file * file = loaded->file.get();
+        if (file->id().valid()) {
+            for (auto other : stack) {
+                if (other->id().same_file(file->id())) {
+                    fprintf(stderr, "%s: response file '%s' includes itself\n", program.c_str(), path);
+                    return false;
+                }
             }
-            if (flag.long_name.size() > 20) {
-                printf("\n                            ");
+        }
+
+        if (!loaded->complete) {
+            char * cursor = file->data();
+            char * end = file->data() + file->size();
+            while (char * token = _next_token(cursor, end)) {
+                loaded->tokens.push_back(token);
             }
-            else {
-                for (size_t i = 0; i < 20 - flag.long_name.size(); ++i) {
-                    printf(" ");
+            loaded->complete = true;
+        }
+
+        stack.push_back(file);
+        for (char * token : loaded->tokens) {
+            if (!_expand_arg(token, stack, passthrough)) {
+                return false;
+            }
+        }
+
+        stack.pop_back();
+        return true;
+    }
+
+    // Find the loaded file for path if it is unchanged and was read completely, so that parsing
+    // again does not map it again, or otherwise load it
+    // Returns nullptr if it cannot be read
+    loaded_file * _load_file(const char * path, bool config)
+    {
+        file_id id = file_id::of(path);
+        if (id.valid()) {
+            for (auto& loaded : _loaded_files) {
+                if (loaded->config == config && loaded->complete && loaded->file->id() == id) {
+                    return loaded.get();
+                }
+            }
+        }
+
+        auto file = std::make_unique<mapped_file>();
+        if (!file->open(path)) {
+            return nullptr;
+        }
+
+        CFLAGS_STAT(stats.estimated_allocations += 2);
+        _loaded_files.push_back(std::make_unique<loaded_file>());
+        _loaded_files.back()->file = std::move(file);
+        _loaded_files.back()->config = config;
+        return _loaded_files.back().get();
+    }
+
+    // Replace argc/argv with a copy where every @file has been expanded
+    // The tokens are not copied, they point into the loaded files
+    bool _expand_response_files()
+    {
+        bool found = false;
+        for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], "--") == 0) {
+                break;
+            }
+            if (argv[i][0] == '@') {
+                found = true;
+                break;
+            }
+        }
+
+        if (!found) {
+            return true;
+        }
+
+        _response_argv.clear();
+        _response_argv.push_back(argv[0]);
+
+        vector<const mapped_file *> stack;
+        bool passthrough = false;
+        for (int i = 1; i < argc; ++i) {
+            if (!_expand_arg(argv[i], stack, passthrough)) {
+                return false;
+            }
+        }
+
+        argc = static_cast<int>(_response_argv.size());
+        argv = _response_argv.data();
+        return true;
+    }
+
+    void _reset_env_index()
+    {
+        _env_index.clear();
+        _env_names.clear();
+        _env_indexed = 0;
+    }
+
+    // Index the environment variable of every flag added since the last call
+    void _index_env()
+    {
+        if (_env_prefix.empty() && _env_bindings.empty()) {
+            _env_indexed = _flags.size();
+            return;
+        }
+
+        for (; _env_indexed < _flags.size(); ++_env_indexed) {
+            flag& flag = _flags[_env_indexed];
+
+            auto binding = _env_bindings.find(&flag);
+            if (binding != _env_bindings.end()) {
+                _env_index.emplace(binding->second, &flag);
+            }
+            else if (!_env_prefix.empty() && !flag.long_name.empty()) {
+                _env_names.push_back(_env_name(flag));
+                _env_index.emplace(_env_names.back(), &flag);
+            }
+        }
+    }
+
+    // The environment variable named after a flag by set_env_prefix()
+    string _env_name(const flag& flag) const
+    {
+        string env_name = _env_prefix;
+        for (char c : flag.long_name) {
+            env_name += (c == '-' ? '_' : static_cast<char>(toupper(static_cast<unsigned char>(c))));
+        }
+        return env_name;
+    }
+
+    // Every flag is processed through here, so that callbacks and copies can be counted
+    // Returns nullptr on success, or a short description of why the value was rejected
+    const char * _process(flag * flag, const char * value)
+    {
+        if (lazy) {
+            // Flags may have been added since the last parse, and earlier values are kept like a target's
+            if (_values._entries.size() < _flags.size()) {
+                _values._entries.resize(_flags.size());
+            }
+
+            ++flag->count;
+            _values._entries[flag->index].set(value);
+            return nullptr;
+        }
+
+#if defined(CFLAGS_STATS)
+        if (value && (flag->type == flag::type::String || flag->type == flag::type::StringCallback)) {
+            stats.bytes_copied += strlen(value);
+        }
+
+        if (flag->type >= flag::type::StringCallback) {
+            using clock = std::chrono::steady_clock;
+
+            auto start = clock::now();
+            const char * error = flag->process(value);
+            auto elapsed = static_cast<unsigned long long>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+
+            ++stats.callbacks;
+            stats.callback_ns += elapsed;
+            flag->stats.callback_ns += elapsed;
+            return error;
+        }
+#endif
+
+        return flag->process(value);
+    }
+
+    // Process every environment variable bound to a flag, in a single pass over the environment
+    bool _apply_env()
+    {
+        if (_env_index.empty()) {
+            return true;
+        }
+
+        for (char ** env = CFLAGS_ENVIRON; env && *env; ++env) {
+            const char * entry = *env;
+            const char * divider = strchr(entry, '=');
+            if (!divider) {
+                continue;
+            }
+
+            // Several flags may be bound to the same variable, so every match is processed
+            auto range = _env_index.equal_range(string_view(entry, divider - entry));
+            for (auto it = range.first; it != range.second; ++it) {
+                if (const char * error = _process(it->second, divider + 1)) {
+                    fprintf(stderr, "%s: invalid value '%s' for environment variable '%.*s': %s\n",
+                        program.c_str(), divider + 1, static_cast<int>(divider - entry), entry, error);
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    vector<const char *> _argv;
+
+    // Searched in order, as there are rarely more than a few dozen commands
+    vector<command_entry> _commands;
+
+    // Owned by an entry in _commands
+    cflags * _command = nullptr;
+
+    // The values recorded by a lazy parse, see get()
+    result _values;
+
+    vector<const char *> _response_argv;
+
+    // Used by parse_cmdline(), the unterminated final argument is held on the heap so moving the flags leaves views into it valid
+    vector<const char *> _cmdline_argv;
+    std::shared_ptr<const string> _cmdline_tail;
+
+    // Response and config files, which parsed values may point into
+    vector<unique_ptr<loaded_file>> _loaded_files;
+
+    string _config_key;
+
+    // Rendered by format_usage() and format_schema(), and kept until the revision changes
+    string _usage_table;
+    string _usage_text;
+    size_t _usage_width = 0;
+    size_t _usage_revision = SIZE_MAX;
+
+    string _schema_text;
+    size_t _schema_revision = SIZE_MAX;
+
+    string _env_prefix;
+
+    // Kept outside of flag, as most flags are never bound
+    unordered_map<const flag *, string> _env_bindings;
+
+    // Keys point into _env_bindings or _env_names
+    std::unordered_multimap<string_view, flag *> _env_index;
+
+    deque<string> _env_names;
+
+    // Flags before this position have had their environment variable indexed
+    size_t _env_indexed = 0;
+
+};
+
+///
+/// One member of an options struct, bound to a flag by a static_schema
+/// T can be bool, int, float, const char *, string_view, string, or a vector of int, float, or string_view
+///
+template <class Options, class T>
+struct field
+{
+    using options_type = Options;
+    using value_type = T;
+
+    char            short_name;
+    char            delimiter;
+    string_view     long_name;
+    T Options::*    member;
+    string_view     description;
+
+    constexpr field(char short_name, string_view long_name, T Options::* member, string_view description, char delimiter = ',')
+        : short_name(short_name)
+        , delimiter(delimiter)
+        , long_name(long_name)
+        , member(member)
+        , description(description)
+    { }
+};
+
+// What _scan() and usage need to know about a field, without its type
+struct static_flag
+{
+    char            short_name = '\0';
+    enum flag::type type = flag::type::Undefined;
+    unsigned        index = 0;
+    string_view     long_name;
+    string_view     description;
+};
+
+///
+/// A set of flags fixed at compile time, which parse directly into the members of an options struct
+/// Construct it as constexpr with make_static_schema(), and nothing is allocated or registered at runtime
+/// Long names are found with a perfect hash built by the constructor, and each value is converted by a
+/// function specialized for its field, with no virtual or std::function calls
+///
+template <class Options, class... Fields>
+class static_schema
+{
+public:
+
+    static constexpr size_t size = sizeof...(Fields);
+
+    constexpr explicit static_schema(Fields... fields)
+        : _fields(fields...)
+        , _flags{}
+        , _short_index{}
+        , _displacement{}
+        , _long_index{}
+    {
+        static_assert((std::is_same_v<typename Fields::options_type, Options> && ...),
+            "every field must be a member of the same options struct");
+
+        _describe(std::index_sequence_for<Fields...>());
+
+        for (size_t i = 0; i < size; ++i) {
+            char short_name = _flags[i].short_name;
+            if (short_name != '\0') {
+                if (_short_index[static_cast<unsigned char>(short_name)] != 0) {
+                    throw std::logic_error("cflags: duplicate short name");
+                }
+                _short_index[static_cast<unsigned char>(short_name)] = static_cast<unsigned>(i + 1);
+            }
+        }
+
+        _build_long_index();
+    }
+
+    constexpr const static_flag * find_long(string_view long_name) const
+    {
+        uint64_t hash = _hash(long_name);
+        uint64_t displacement = _displacement[_mix(hash) & (_bucket_count - 1)];
+        unsigned entry = _long_index[_mix(hash + displacement * _golden) & (_slot_count - 1)];
+        if (entry == 0 || _flags[entry - 1].long_name != long_name) {
+            return nullptr;
+        }
+        return &_flags[entry - 1];
+    }
+
+    constexpr const static_flag * find_short(char short_name) const
+    {
+        unsigned entry = _short_index[static_cast<unsigned char>(short_name)];
+        return (entry == 0 ? nullptr : &_flags[entry - 1]);
+    }
+
+    constexpr const array<static_flag, size>& flags() const
+    {
+        return _flags;
+    }
+
+    ///
+    /// Parse argv into options, leaving members for flags that were not given unchanged
+    /// Positional arguments are appended to args if it is set
+    /// On failure the message is stored in error if it is set, or printed to stderr otherwise
+    ///
+    bool parse(int argc, const char * const * argv, Options& options, vector<const char *> * args = nullptr, string * error = nullptr) const
+    {
+        using processor = const char * (*)(const static_schema&, Options&, const char *);
+        static constexpr array<processor, size> processors = _processors(std::index_sequence_for<Fields...>());
+
+        struct handler
+        {
+            const static_schema& owner;
+            Options& options;
+            vector<const char *> * args;
+            string * message;
+
+            const static_flag * find_long(string_view long_name) { return owner.find_long(long_name); }
+            const static_flag * find_short(char short_name) { return owner.find_short(short_name); }
+
+            // Names are fixed, so there is no prefix index
+            const static_flag * find_prefix(string_view, string&) { return nullptr; }
+
+            string suggest(string_view long_name) const { return schema::_suggest(long_name, owner._flags); }
+
+            const char * process(const static_flag * flag, const char * value)
+            {
+                return processors[flag->index](owner, options, value);
+            }
+
+            bool has_command(string_view) const { return false; }
+            bool command(int, const char * const *, bool&) { return false; }
+
+            void positional(const char * arg)
+            {
+                if (args) {
+                    args->push_back(arg);
+                }
+            }
+
+            void error(string text)
+            {
+                if (message) {
+                    *message = std::move(text);
+                }
+                else {
+                    fprintf(stderr, "%s\n", text.c_str());
                 }
             }
-            printf("%s\n", flag.description.c_str());
+        };
+
+        if (args) {
+            args->clear();
         }
 
-        printf("\n%s\n", below.c_str());
+        handler handler{ *this, options, args, error };
+        return schema::_scan(argc, argv, handler);
     }
 
 private:
 
-    vector<char *> _argv;
-    
-    vector<flag> _flags;
+    std::tuple<Fields...> _fields;
+
+    array<static_flag, size> _flags;
+
+    // Indices are stored plus one, so that zero is empty
+    array<unsigned, 256> _short_index;
+
+    // Each long name hashes to a bucket, whose displacement moves it to a slot of its own
+    // There are at least as many buckets as flags, and twice as many slots
+    static constexpr size_t _round_up(size_t count)
+    {
+        size_t power = 1;
+        while (power < count) {
+            power *= 2;
+        }
+        return power;
+    }
+
+    static constexpr size_t _bucket_count = _round_up(size);
+    static constexpr size_t _slot_count = _round_up(size * 2);
+    static constexpr uint64_t _golden = 0x9e3779b97f4a7c15ull;
+
+    array<uint32_t, _bucket_count> _displacement;
+    array<unsigned, _slot_count> _long_index;
+
+    // FNV-1a, finished with the MurmurHash3 mixer so the low bits can be used directly
+    static constexpr uint64_t _hash(string_view str)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (char c : str) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static constexpr uint64_t _mix(uint64_t hash)
+    {
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    template <size_t... I>
+    constexpr void _describe(std::index_sequence<I...>)
+    {
+        ((_flags[I] = static_flag{
+            std::get<I>(_fields).short_name,
+            _type<typename Fields::value_type>(),
+            static_cast<unsigned>(I),
+            std::get<I>(_fields).long_name,
+            std::get<I>(_fields).description,
+        }), ...);
+    }
+
+    // Buckets are placed largest first, trying displacements until every name in the bucket lands in a free slot
+    constexpr void _build_long_index()
+    {
+        array<uint64_t, size> hashes{};
+        array<size_t, _bucket_count> bucket_sizes{};
+        size_t largest = 0;
+        for (size_t i = 0; i < size; ++i) {
+            if (_flags[i].long_name.empty()) {
+                continue;
+            }
+            hashes[i] = _hash(_flags[i].long_name);
+            size_t bucket_size = ++bucket_sizes[_mix(hashes[i]) & (_bucket_count - 1)];
+            largest = (bucket_size > largest ? bucket_size : largest);
+        }
+
+        for (size_t bucket_size = largest; bucket_size > 0; --bucket_size) {
+            for (size_t bucket = 0; bucket < _bucket_count; ++bucket) {
+                if (bucket_sizes[bucket] != bucket_size) {
+                    continue;
+                }
+
+                array<size_t, size> members{};
+                size_t member_count = 0;
+                for (size_t i = 0; i < size; ++i) {
+                    if (!_flags[i].long_name.empty() && (_mix(hashes[i]) & (_bucket_count - 1)) == bucket) {
+                        for (size_t j = 0; j < member_count; ++j) {
+                            if (hashes[members[j]] == hashes[i]) {
+                                throw std::logic_error("cflags: duplicate long name");
+                            }
+                        }
+                        members[member_count++] = i;
+                    }
+                }
+
+                for (uint32_t displacement = 0; ; ++displacement) {
+                    if (displacement == 0x10000) {
+                        throw std::logic_error("cflags: unable to build a perfect hash");
+                    }
+
+                    array<size_t, size> slots{};
+                    bool placed = true;
+                    for (size_t j = 0; j < member_count && placed; ++j) {
+                        slots[j] = _mix(hashes[members[j]] + displacement * _golden) & (_slot_count - 1);
+                        placed = (_long_index[slots[j]] == 0);
+                        for (size_t k = 0; k < j && placed; ++k) {
+                            placed = (slots[k] != slots[j]);
+                        }
+                    }
+
+                    if (placed) {
+                        for (size_t j = 0; j < member_count; ++j) {
+                            _long_index[slots[j]] = static_cast<unsigned>(members[j] + 1);
+                        }
+                        _displacement[bucket] = displacement;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    template <class T>
+    static constexpr enum flag::type _type()
+    {
+        if constexpr (std::is_same_v<T, bool>) {
+            return flag::type::Bool;
+        }
+        else if constexpr (std::is_same_v<T, int>) {
+            return flag::type::Int;
+        }
+        else if constexpr (std::is_same_v<T, float>) {
+            return flag::type::Float;
+        }
+        else if constexpr (std::is_same_v<T, string>) {
+            return flag::type::String;
+        }
+        else if constexpr (std::is_same_v<T, const char *> || std::is_same_v<T, string_view>) {
+            return flag::type::CString;
+        }
+        else if constexpr (std::is_same_v<T, vector<string_view>>) {
+            return flag::type::StringViewList;
+        }
+        else if constexpr (std::is_same_v<T, vector<int>>) {
+            return flag::type::IntList;
+        }
+        else {
+            static_assert(std::is_same_v<T, vector<float>>, "unsupported field type");
+            return flag::type::FloatList;
+        }
+    }
+
+    // A value is only nullptr for a bool given without one
+    template <size_t I>
+    static const char * _process(const static_schema& owner, Options& options, const char * value)
+    {
+        const auto& field = std::get<I>(owner._fields);
+        auto& out = options.*(field.member);
+        using T = typename std::tuple_element_t<I, std::tuple<Fields...>>::value_type;
+
+        if constexpr (std::is_same_v<T, bool>) {
+            out = (value ? flag::parse_bool(value) : true);
+            return nullptr;
+        }
+        else if constexpr (std::is_same_v<T, int> || std::is_same_v<T, float>) {
+            return from_string(value, out);
+        }
+        else if constexpr (std::is_same_v<T, const char *> || std::is_same_v<T, string_view> || std::is_same_v<T, string>) {
+            out = value;
+            return nullptr;
+        }
+        else {
+            return split_list(value, field.delimiter, out);
+        }
+    }
+
+    template <size_t... I>
+    static constexpr auto _processors(std::index_sequence<I...>)
+    {
+        using processor = const char * (*)(const static_schema&, Options&, const char *);
+        return array<processor, size>{ { &_process<I>... } };
+    }
 
 };
 
+///
+/// Build a static_schema from fields of the same options struct, e.g.
+/// constexpr auto schema = cflags::make_static_schema(cflags::field('t', "threads", &options::threads, "number of threads"));
+///
+template <class First, class... Rest>
+constexpr auto make_static_schema(First first, Rest... rest)
+{
+    return static_schema<typename First::options_type, First, Rest...>(first, rest...);
+}
+
 } // namespace cflags
 
 #endif // CFLAGS_HPP
\ No newline at end of file